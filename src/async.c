@@ -9,15 +9,60 @@
 void settimeout(Conn *);
 void setevents(Conn *);
 
+// Absolute timer deadline in the past, expiring on the next loop turn
+#define DEADLINE_NOW 1
+
+static void armtimer(Conn *, uint64_t);
+
+uint64_t now_usec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+// Dispatch queued messages until sd-bus has no more work or the budget
+// of the connection runs out. In the latter case the timer is armed to
+// expire immediately, so that the remaining messages are dispatched
+// after other events on the Janet event loop.
 static void process_bus(Conn *conn) {
+  uint64_t start = now_usec();
+  uint32_t count = 0;
+  bool exhausted = false;
+
   int rv;
+  conn->dispatching = true;
   while ((rv = sd_bus_process(conn->bus, NULL)) > 0) {
+    count++;
+    if (conn->budget && count >= conn->budget) {
+      exhausted = true;
+      break;
+    }
+
+    if (conn->slice && now_usec() - start >= conn->slice) {
+      exhausted = true;
+      break;
+    }
   }
+  conn->dispatching = false;
+
+  uint64_t elapsed = now_usec() - start;
+  if (elapsed > conn->max_pass)
+    conn->max_pass = elapsed;
+
+  filter_flush(conn, now_usec());
+  flush_batches(conn, NULL);
 
   if (rv < 0)
     janet_panicf("failed to call sd_bus_process: %s", strerror(-rv));
 
   setevents(conn);
+
+  if (exhausted) {
+    conn->budget_hits++;
+    armtimer(conn, DEADLINE_NOW);
+    return;
+  }
+
   settimeout(conn);
 }
 
@@ -33,21 +78,59 @@ static uint32_t getevents(sd_bus *bus) {
   return flags;
 }
 
+// Re-registering the bus stream costs an epoll_ctl, so it is only done
+// when sd-bus wants a different set of events
 void setevents(Conn *conn) {
-  uint32_t newflags       = getevents(conn->bus);
+  // Blocking connections are not registered on the event loop
+  if (!conn->bus_stream)
+    return;
+
+  uint32_t newflags = getevents(conn->bus);
+  if (newflags == conn->events) {
+    conn->skipped++;
+    return;
+  }
+
   conn->bus_stream->flags = (conn->bus_stream->flags &
                              ~(JANET_STREAM_READABLE | JANET_STREAM_WRITABLE)) |
                             newflags;
 
   janet_stream_edge_triggered(conn->bus_stream);
+  conn->events = newflags;
+  conn->syscalls++;
 }
 
 void settimeout(Conn *conn) {
+  if (!conn->timer)
+    return;
+
   uint64_t usec = 0;
   CALL_SD_BUS_FUNC(sd_bus_get_timeout, conn->bus, &usec);
 
   if (usec == 0) {
-    process_bus(conn);
+    // Pending work is left to the next loop turn when dispatching is
+    // budgeted, or when called from a match callback, since sd-bus
+    // does not allow sd_bus_process to be re-entered.
+    if (conn->budget || conn->slice || conn->dispatching)
+      armtimer(conn, DEADLINE_NOW);
+    else
+      process_bus(conn);
+
+    return;
+  }
+
+  // Wake up when the coalescing window of a held message closes
+  uint64_t held = filter_deadline(conn);
+  if (held < usec)
+    usec = held;
+
+  armtimer(conn, usec);
+}
+
+static void armtimer(Conn *conn, uint64_t usec) {
+  // The timer is already armed for this deadline
+  if (usec == conn->deadline) {
+    conn->skipped++;
     return;
   }
 
@@ -60,6 +143,34 @@ void settimeout(Conn *conn) {
   if (timerfd_settime(conn->timer->handle, TFD_TIMER_ABSTIME, &new_value,
                       NULL) == -1)
     janet_panicf("timerfd_settime: %s", strerror(errno));
+
+  conn->deadline = usec;
+  conn->syscalls++;
+}
+
+void init_async_pending(AsyncPending *pending, JanetChannel *ch, bool slot) {
+  pending->chan     = ch;
+  pending->batch    = false;
+  pending->callback = NULL;
+  pending->fiber    = NULL;
+  pending->filter   = NULL;
+  pending->cookie   = 0;
+  pending->calls    = 1;
+  pending->bus_slot = NULL;
+  pending->group    = NULL;
+  pending->slot     = NULL;
+
+  if (slot) {
+    BusSlot *slot_obj = janet_abstract(&dbus_slot_type, sizeof(BusSlot));
+    *slot_obj         = (BusSlot) { 0 };
+    pending->slot     = &slot_obj->slot;
+  }
+}
+
+void require_event_loop(Conn *conn) {
+  if (conn->bus && !conn->timer)
+    janet_panic("connection was opened as blocking and does not support "
+                "async calls");
 }
 
 AsyncPending *create_async_pending(JanetChannel *ch) {
@@ -67,55 +178,132 @@ AsyncPending *create_async_pending(JanetChannel *ch) {
   if (!(pending = janet_malloc(sizeof(AsyncPending))))
     JANET_OUT_OF_MEMORY;
 
-  pending->chan  = ch;
-  pending->slot  = janet_abstract(&dbus_slot_type, sizeof(sd_bus_slot *));
-  *pending->slot = NULL;
-
+  init_async_pending(pending, ch, false);
   return pending;
 }
 
-void queue_pending(AsyncPending **head, AsyncPending *pending) {
+void queue_pending(Conn *conn, AsyncPending *pending) {
   pending->prev = NULL;
-  pending->next = *head;
+  pending->next = conn->queue;
 
-  if (*head)
-    (*head)->prev = pending;
+  if (conn->queue)
+    conn->queue->prev = pending;
 
-  *head = pending;
+  conn->queue = pending;
+
+  if (pending->kind == Call)
+    conn->ncalls += pending->calls;
 }
 
-void dequeue_pending(AsyncPending **head, AsyncPending *pending) {
-  if (!head || !*head)
+void dequeue_pending(Conn *conn, AsyncPending *pending) {
+  // Replies dequeue their call before the slot is destroyed
+  if (!pending->prev && conn->queue != pending)
     return;
 
   if (pending->prev)
     pending->prev->next = pending->next;
   else
-    *head = pending->next;
+    conn->queue = pending->next;
 
   if (pending->next)
     pending->next->prev = pending->prev;
+
+  pending->prev = pending->next = NULL;
+
+  if (pending->kind == Call)
+    conn->ncalls -= pending->calls;
+}
+
+// Settle `n` of the method calls counted by a queued entry
+void settle_calls(Conn *conn, AsyncPending *pending, int32_t n) {
+  if (!pending->prev && conn->queue != pending)
+    return;
+
+  pending->calls -= n;
+  conn->ncalls -= n;
+}
+
+void batch_push(Conn *conn, JanetChannel *chan, Janet msg) {
+  Batch *batch = conn->batches;
+  while (batch && batch->chan != chan)
+    batch = batch->next;
+
+  if (!batch) {
+    if (!(batch = janet_malloc(sizeof(Batch))))
+      JANET_OUT_OF_MEMORY;
+
+    *batch = (Batch) { .chan = chan,
+                       .msgs = janet_array(16),
+                       .next = conn->batches };
+
+    janet_gcroot(janet_wrap_abstract(chan));
+    janet_gcroot(janet_wrap_array(batch->msgs));
+    conn->batches = batch;
+  }
+
+  janet_array_push(batch->msgs, msg);
+}
+
+// Deliver held messages as a single `[:ok msgs]` tuple per channel,
+// either for every channel or only `chan` so that a message delivered
+// individually is not written before earlier ones
+void flush_batches(Conn *conn, JanetChannel *chan) {
+  Batch **p = &conn->batches;
+  while (*p) {
+    Batch *batch = *p;
+    if (chan && batch->chan != chan) {
+      p = &batch->next;
+      continue;
+    }
+
+    *p = batch->next;
+
+    CHAN_PUSH(batch->chan, janet_ckeywordv("ok"),
+              janet_wrap_array(batch->msgs));
+
+    janet_gcunroot(janet_wrap_array(batch->msgs));
+    janet_gcunroot(janet_wrap_abstract(batch->chan));
+    janet_free(batch);
+  }
 }
 
 static void closeall_pending(Conn *conn, Janet status, Janet msg) {
+  flush_batches(conn, NULL);
+
   if (!conn->queue)
     return;
 
   Janet tuple = janet_wrap_tuple(TUPLE(status, msg));
 
   AsyncPending *p = conn->queue;
+  conn->queue     = NULL;
+  conn->ncalls    = 0;
+
   while (p) {
     AsyncPending *next = p->next;
 
-    janet_channel_give(p->chan, tuple);
+    // Destroy callbacks find their entries already dequeued
+    p->prev = p->next = NULL;
+
+    if (p->chan)
+      janet_channel_give(p->chan, tuple);
 
-    sd_bus_slot_unrefp(p->slot);
-    *p->slot = NULL;
+    // The bus may outlive the connection while messages still
+    // reference it, so floating slots are disconnected now rather
+    // than when the bus is freed. This releases the entry.
+    sd_bus_slot *bus_slot = p->bus_slot;
+    if (p->slot) {
+      sd_bus_slot_unrefp(p->slot);
+      *p->slot = NULL;
+    }
+
+    if (p->group)
+      group_disconnect(p->group);
+    else if (bus_slot)
+      sd_bus_slot_set_floating(bus_slot, 0);
 
     p = next;
   }
-
-  conn->queue = NULL;
 }
 
 static void timer_callback(JanetFiber *fiber, JanetAsyncEvent event) {
@@ -128,6 +316,9 @@ static void timer_callback(JanetFiber *fiber, JanetAsyncEvent event) {
       if (rv == -1 && errno == EBADF)
         janet_panic("Timer file descriptor unexpectedly closed");
 
+      // A one-shot timer is disarmed once it expires
+      conn->deadline = UINT64_MAX;
+
       process_bus(conn);
       break;
     }
@@ -198,9 +389,11 @@ void init_async(Conn *conn) {
 
   conn->timer =
       janet_poll(conn, timer_fd, JANET_STREAM_READABLE, timer_callback);
+  conn->deadline = UINT64_MAX;
 
   int bus_fd       = CALL_SD_BUS_FUNC(sd_bus_get_fd, conn->bus);
   uint32_t flags   = getevents(conn->bus);
   conn->bus_stream = janet_poll(
       conn, bus_fd, flags | JANET_STREAM_NOT_CLOSEABLE, bus_callback);
+  conn->events = flags;
 }
@@ -0,0 +1,231 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Joshua Krusell
+
+// memfd_create and file sealing
+#define _GNU_SOURCE
+
+#include "common.h"
+#include "unwrap.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Seals required before a blob may be mapped. Without these the
+// sender could modify or truncate the file under the mapping.
+#define BLOB_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE)
+
+// Sealed memfd with a read-only mapping of its contents
+typedef struct {
+  int fd;
+  const uint8_t *data; // NULL when empty or closed
+  size_t size;
+} Blob;
+
+static int dbus_blob_gc(void *, size_t);
+static int dbus_blob_get(void *, Janet, Janet *);
+static size_t dbus_blob_length(void *, size_t);
+static JanetByteView dbus_blob_bytes(void *, size_t);
+const JanetAbstractType dbus_blob_type = { .name      = "sdbus/blob",
+                                           .gc        = dbus_blob_gc,
+                                           .gcmark    = NULL,
+                                           .get       = dbus_blob_get,
+                                           .put       = NULL,
+                                           .marshal   = NULL,
+                                           .unmarshal = NULL,
+                                           .tostring  = NULL,
+                                           .compare   = NULL,
+                                           .hash      = NULL,
+                                           .next      = NULL,
+                                           .call      = NULL,
+                                           .length    = dbus_blob_length,
+                                           .bytes     = dbus_blob_bytes,
+                                           JANET_ATEND_BYTES };
+
+JANET_CFUN(cfun_blob_close);
+static JanetMethod dbus_blob_methods[] = {
+  { "close", cfun_blob_close },
+  { NULL,    NULL            }
+};
+
+static void blob_close(Blob *blob) {
+  if (blob->data)
+    munmap((void *) blob->data, blob->size);
+
+  if (blob->fd >= 0)
+    close(blob->fd);
+
+  blob->data = NULL;
+  blob->fd   = -1;
+  blob->size = 0;
+}
+
+static int dbus_blob_gc(void *p, size_t size) {
+  UNUSED(size);
+  blob_close(p);
+
+  return 0;
+}
+
+static int dbus_blob_get(void *p, Janet key, Janet *out) {
+  Blob *blob = p;
+
+  if (janet_checktype(key, JANET_KEYWORD))
+    return janet_getmethod(janet_unwrap_keyword(key), dbus_blob_methods, out);
+
+  if (!janet_checkint(key))
+    return 0;
+
+  int32_t index = janet_unwrap_integer(key);
+  if (index < 0 || (size_t) index >= blob->size)
+    return 0;
+
+  *out = janet_wrap_integer(blob->data[index]);
+  return 1;
+}
+
+static size_t dbus_blob_length(void *p, size_t size) {
+  UNUSED(size);
+  return ((Blob *) p)->size;
+}
+
+static JanetByteView dbus_blob_bytes(void *p, size_t size) {
+  UNUSED(size);
+
+  Blob *blob = p;
+  return (JanetByteView) { blob->data, (int32_t) blob->size };
+}
+
+// Map a sealed memfd read-only. Takes ownership of `fd`, closing it
+// on failure.
+static Blob *blob_map(int fd) {
+  int seals = fcntl(fd, F_GET_SEALS);
+  if (seals == -1 || (seals & BLOB_SEALS) != BLOB_SEALS) {
+    close(fd);
+    janet_panic("file descriptor is not a sealed memfd");
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    int err = errno;
+    close(fd);
+    janet_panicf("fstat failed for fd=%d: %s", fd, strerror(err));
+  }
+
+  if ((uint64_t) st.st_size > INT32_MAX) {
+    close(fd);
+    janet_panicf("blob of %jd bytes is too large", (intmax_t) st.st_size);
+  }
+
+  const uint8_t *data = NULL;
+  if (st.st_size > 0) {
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+      int err = errno;
+      close(fd);
+      janet_panicf("mmap failed for fd=%d: %s", fd, strerror(err));
+    }
+  }
+
+  Blob *blob = janet_abstract(&dbus_blob_type, sizeof(Blob));
+  *blob      = (Blob) { .fd = fd, .data = data, .size = st.st_size };
+
+  return blob;
+}
+
+// Duplicate `fd` and map it as a blob if it is a sealed memfd.
+// Returns 1 on success, 0 if `fd` is not a sealed memfd.
+int blob_from_fd(int fd, Janet *out) {
+  int seals = fcntl(fd, F_GET_SEALS);
+  if (seals == -1 || (seals & BLOB_SEALS) != BLOB_SEALS)
+    return 0;
+
+  int copy;
+  if ((copy = fcntl(fd, F_DUPFD_CLOEXEC, 3)) == -1)
+    janet_panicf("fcntl(F_DUPFD_CLOEXEC) failed for fd=%d: %s", fd,
+                 strerror(errno));
+
+  *out = janet_wrap_abstract(blob_map(copy));
+  return 1;
+}
+
+int blob_getfd(void *p) {
+  Blob *blob = p;
+  if (blob->fd < 0)
+    janet_panic("bad argument to D-Bus type 'h', blob is closed");
+
+  return blob->fd;
+}
+
+static void write_all(int fd, const uint8_t *bytes, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, bytes, len);
+    if (n == -1 && errno == EINTR)
+      continue;
+
+    if (n == -1) {
+      int err = errno;
+      close(fd);
+      janet_panicf("failed to write blob: %s", strerror(err));
+    }
+
+    bytes += n;
+    len -= n;
+  }
+}
+
+JANET_FN(cfun_blob, "(sdbus/blob bytes)",
+         "Copy `bytes` into a sealed, read-only memfd. The returned blob "
+         "may be appended to a message as a D-Bus 'h' argument so that "
+         "large payloads are passed as a file descriptor rather than "
+         "copied through the message bus.\n\n"
+         "Blobs also behave as read-only byte sequences, supporting "
+         "`length`, `get`, and any function accepting bytes.") {
+  janet_fixarity(argc, 1);
+
+  JanetByteView bytes = janet_getbytes(argv, 0);
+
+  int fd = memfd_create("janet-sdbus-blob", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd == -1)
+    janet_panicf("memfd_create failed: %s", strerror(errno));
+
+  write_all(fd, bytes.bytes, bytes.len);
+
+  if (fcntl(fd, F_ADD_SEALS, BLOB_SEALS | F_SEAL_SEAL) == -1) {
+    int err = errno;
+    close(fd);
+    janet_panicf("failed to seal blob: %s", strerror(err));
+  }
+
+  return janet_wrap_abstract(blob_map(fd));
+}
+
+JANET_FN(cfun_blob_open, "(sdbus/blob-open fd)",
+         "Map a sealed memfd received in a D-Bus message, given as a "
+         "core/stream or core/file, as a read-only blob without copying "
+         "its contents. Raises an error if the file descriptor is not "
+         "sealed against writing and resizing.") {
+  janet_fixarity(argc, 1);
+
+  Janet blob;
+  if (!blob_from_fd(getfd(argv[0]), &blob))
+    janet_panic("file descriptor is not a sealed memfd");
+
+  return blob;
+}
+
+JANET_FN(cfun_blob_close, "(sdbus/blob-close blob)",
+         "Unmap a blob and close its file descriptor. The blob is empty "
+         "afterwards. Blobs are otherwise closed when garbage "
+         "collected.") {
+  janet_fixarity(argc, 1);
+
+  Blob *blob = janet_getabstract(argv, 0, &dbus_blob_type);
+  blob_close(blob);
+
+  return janet_wrap_nil();
+}
+
+JanetRegExt cfuns_blob[] = { JANET_REG("blob", cfun_blob),
+                             JANET_REG("blob-open", cfun_blob_open),
+                             JANET_REG("blob-close", cfun_blob_close),
+                             JANET_REG_END };
@@ -31,7 +31,9 @@ static int dbus_bus_gc(void *p, size_t size) {
   UNUSED(size);
   Conn *conn = (Conn *) p;
 
+  capture_free(conn);
   sd_bus_flush_close_unref(conn->bus);
+  free_call_states(conn);
 
   return 0;
 }
@@ -46,6 +48,9 @@ static int dbus_bus_gcmark(void *p, size_t size) {
   if (conn->timer)
     janet_mark(janet_wrap_abstract(conn->timer));
 
+  if (conn->capture)
+    janet_mark(janet_wrap_buffer(conn->capture->buffer));
+
   return 0;
 }
 
@@ -76,40 +81,49 @@ static Janet dbus_bus_next(void *p, Janet key) {
   return janet_nextmethod(dbus_bus_methods, key);
 }
 
-#define OPEN_BUS_CORE(CALL)                                                    \
+#define OPEN_BUS_CORE(CALL, ASYNC)                                             \
   do {                                                                         \
     Conn *conn = janet_abstract(&dbus_bus_type, sizeof(Conn));                 \
     memset(conn, 0, sizeof(Conn));                                             \
                                                                                \
     CALL;                                                                      \
-    init_async(conn);                                                          \
+    if (ASYNC)                                                                 \
+      init_async(conn);                                                        \
                                                                                \
     return janet_wrap_abstract(conn);                                          \
   } while (0)
 
-#define OPEN_BUS0(fun) OPEN_BUS_CORE(CALL_SD_BUS_FUNC(fun, &conn->bus))
+#define OPEN_BUS0(fun, async)                                                  \
+  OPEN_BUS_CORE(CALL_SD_BUS_FUNC(fun, &conn->bus), async)
 
 #define OPEN_BUS1(fun, arg)                                                    \
-  OPEN_BUS_CORE(CALL_SD_BUS_FUNC(fun, &conn->bus, arg))
+  OPEN_BUS_CORE(CALL_SD_BUS_FUNC(fun, &conn->bus, arg), true)
 
 JANET_FN(
-    cfun_open_user_bus, "(sdbus/open-user-bus)",
+    cfun_open_user_bus, "(sdbus/open-user-bus &opt blocking)",
     "Open a user D-Bus connection. "
-    "The returned connection must be explicitly closed before program exit.") {
-  UNUSED(argv);
-  janet_fixarity(argc, 0);
-
-  OPEN_BUS0(sd_bus_open_user);
+    "The returned connection must be explicitly closed before program "
+    "exit.\n\n"
+    "If `blocking` is truthy, the connection is not registered on the "
+    "event loop and only supports blocking calls with `sdbus/call-sync` "
+    "and sending messages. Such a connection does not need to be closed "
+    "for the program to exit.") {
+  janet_arity(argc, 0, 1);
+  bool blocking = argc == 1 && janet_truthy(argv[0]);
+
+  OPEN_BUS0(sd_bus_open_user, !blocking);
 }
 
 JANET_FN(
-    cfun_open_system_bus, "(sdbus/open-system-bus)",
+    cfun_open_system_bus, "(sdbus/open-system-bus &opt blocking)",
     "Open a system D-Bus connection. "
-    "The returned connection must be explicitly closed before program exit.") {
-  UNUSED(argv);
-  janet_fixarity(argc, 0);
+    "The returned connection must be explicitly closed before program "
+    "exit.\n\n"
+    "`blocking` is the same as for `sdbus/open-user-bus`.") {
+  janet_arity(argc, 0, 1);
+  bool blocking = argc == 1 && janet_truthy(argv[0]);
 
-  OPEN_BUS0(sd_bus_open_system);
+  OPEN_BUS0(sd_bus_open_system, !blocking);
 }
 
 JANET_FN(
@@ -142,11 +156,7 @@ JANET_FN(
   OPEN_BUS1(sd_bus_open_system_remote, host);
 }
 
-JANET_FN(cfun_close_bus, "(sdbus/close-bus bus)",
-         "Close a D-Bus connection. Returns `nil`.") {
-  janet_fixarity(argc, 1);
-
-  Conn *conn = janet_getabstract(argv, 0, &dbus_bus_type);
+void close_conn(Conn *conn) {
   if (conn->bus_stream) {
     janet_stream_close(conn->bus_stream);
     conn->bus_stream = NULL;
@@ -157,9 +167,25 @@ JANET_FN(cfun_close_bus, "(sdbus/close-bus bus)",
     conn->timer = NULL;
   }
 
+  // Captured data remains available until taken
+  if (conn->capture)
+    capture_stop(conn->capture);
+
   sd_bus_flush_close_unref(conn->bus);
   conn->bus = NULL;
 
+  // Pending slots were disconnected when the bus stream closed,
+  // returning their states
+  free_call_states(conn);
+}
+
+JANET_FN(cfun_close_bus, "(sdbus/close-bus bus)",
+         "Close a D-Bus connection. Returns `nil`.") {
+  janet_fixarity(argc, 1);
+
+  Conn *conn = janet_getabstract(argv, 0, &dbus_bus_type);
+  close_conn(conn);
+
   return janet_wrap_nil();
 }
 
@@ -204,6 +230,70 @@ JANET_FN(
   return janet_wrap_nil();
 }
 
+JANET_FN(cfun_set_process_budget,
+         "(sdbus/set-process-budget bus messages &opt slice)",
+         "Bound the work done each time a D-Bus connection is woken up by "
+         "the event loop to `messages` dispatched messages and, if given, "
+         "`slice` seconds. Remaining messages are dispatched after other "
+         "pending events, so that a flood of incoming signals cannot "
+         "starve other fibers. Either bound may be nil or 0 to disable "
+         "it. By default dispatching is unbounded. Returns nil.") {
+  janet_arity(argc, 2, 3);
+
+  Conn *conn = janet_getabstract(argv, 0, &dbus_bus_type);
+
+  uint32_t budget = 0;
+  if (!janet_checktype(argv[1], JANET_NIL))
+    budget = (uint32_t) janet_getnat(argv, 1);
+
+  double slice = 0;
+  if (argc == 3 && !janet_checktype(argv[2], JANET_NIL)) {
+    slice = janet_getnumber(argv, 2);
+    if (!(slice >= 0) || slice > 3600)
+      janet_panicf("expected time slice between 0 and 3600 seconds, got %v",
+                   argv[2]);
+  }
+
+  conn->budget = budget;
+  conn->slice  = (uint64_t) (slice * 1e6);
+
+  return janet_wrap_nil();
+}
+
+JANET_FN(cfun_bus_stats, "(sdbus/bus-stats bus &opt reset)",
+         "Return a struct with event loop counters for a D-Bus connection. "
+         "`:syscalls` is the number of times the timeout timer was rearmed "
+         "or the events polled for on the connection were changed, and "
+         "`:skipped` the number of such updates avoided because nothing "
+         "had changed. `:budget-hits` is the number of times dispatching "
+         "stopped early due to `sdbus/set-process-budget`, and `:max-pass` "
+         "the longest time in seconds spent dispatching messages in one "
+         "pass. If `reset` is truthy, the counters are zeroed after "
+         "reading.") {
+  janet_arity(argc, 1, 2);
+
+  Conn *conn = janet_getabstract(argv, 0, &dbus_bus_type);
+
+  JanetKV *st = janet_struct_begin(4);
+  janet_struct_put(st, janet_ckeywordv("syscalls"),
+                   janet_wrap_number((double) conn->syscalls));
+  janet_struct_put(st, janet_ckeywordv("skipped"),
+                   janet_wrap_number((double) conn->skipped));
+  janet_struct_put(st, janet_ckeywordv("budget-hits"),
+                   janet_wrap_number((double) conn->budget_hits));
+  janet_struct_put(st, janet_ckeywordv("max-pass"),
+                   janet_wrap_number((double) conn->max_pass / 1e6));
+
+  if (argc == 2 && janet_truthy(argv[1])) {
+    conn->syscalls    = 0;
+    conn->skipped     = 0;
+    conn->budget_hits = 0;
+    conn->max_pass    = 0;
+  }
+
+  return janet_wrap_struct(janet_struct_end(st));
+}
+
 JANET_FN(cfun_list_names, "(sdbus/list-names bus)",
          "Returns a list registered names on a D-Bus connection.") {
   janet_fixarity(argc, 1);
@@ -238,5 +328,7 @@ JanetRegExt cfuns_bus[] = {
   JANET_REG("set-allow-interactive-authorization",
             cfun_set_allow_interactive_authorization),
   JANET_REG("list-names", cfun_list_names),
+  JANET_REG("set-process-budget", cfun_set_process_budget),
+  JANET_REG("bus-stats", cfun_bus_stats),
   JANET_REG_END
 };
@@ -3,16 +3,15 @@
 
 #include "common.h"
 
-#define FREE_CALL_STATE(state)                                                 \
-  do {                                                                         \
-    janet_free(state->pending);                                                \
-    janet_free(state);                                                         \
-  } while (0)
+// Freed call states kept per connection for reuse
+#define CALL_STATE_CACHE 256
 
-typedef struct {
-  Conn *conn;
-  AsyncPending *pending;
-} AsyncState;
+// State of an async call or match, allocated as a single block
+typedef struct CallState {
+  AsyncState state;
+  AsyncPending pending;
+  struct CallState *next; // Next free state on the connection
+} CallState;
 
 static JanetString format_error(sd_bus_error *error) {
   const char *fmt =
@@ -22,23 +21,67 @@ static JanetString format_error(sd_bus_error *error) {
   return str;
 }
 
-static AsyncState *init_callback_state(Conn *conn, JanetChannel *ch) {
-  AsyncPending *pending = create_async_pending(ch);
-
-  AsyncState *state;
-  if (!(state = janet_malloc(sizeof(AsyncState))))
+// Only calls that may be cancelled need a slot object, so `slot` may
+// be false to skip its allocation
+static AsyncState *init_callback_state(Conn *conn, JanetChannel *ch,
+                                       bool slot) {
+  require_event_loop(conn);
+
+  CallState *cs = conn->spare;
+  if (cs) {
+    conn->spare = cs->next;
+    conn->nspare--;
+  } else if (!(cs = janet_malloc(sizeof(CallState)))) {
     JANET_OUT_OF_MEMORY;
-  *state = (AsyncState) { .conn = conn, .pending = pending };
+  }
 
-  return state;
+  init_async_pending(&cs->pending, ch, slot);
+  cs->state = (AsyncState) { .conn = conn, .pending = &cs->pending };
+
+  return &cs->state;
+}
+
+static void free_callback_state(AsyncState *state) {
+  Conn *conn    = state->conn;
+  CallState *cs = (CallState *) state;
+
+  if (conn->nspare >= CALL_STATE_CACHE) {
+    janet_free(cs);
+    return;
+  }
+
+  cs->next    = conn->spare;
+  conn->spare = cs;
+  conn->nspare++;
+}
+
+void free_call_states(Conn *conn) {
+  while (conn->spare) {
+    CallState *next = conn->spare->next;
+    janet_free(conn->spare);
+    conn->spare = next;
+  }
+
+  conn->nspare = 0;
 }
 
 static void destroy_call_callback(void *userdata) {
-  AsyncState *state    = userdata;
+  AsyncState *state = userdata;
+  if (state->pending->slot)
+    ((BusSlot *) state->pending->slot)->filter = NULL;
+
   state->pending->slot = NULL;
-  dequeue_pending(&state->conn->queue, state->pending);
+  dequeue_pending(state->conn, state->pending);
+
+  if (state->pending->callback)
+    janet_gcunroot(janet_wrap_function(state->pending->callback));
+
+  if (state->pending->fiber)
+    janet_gcunroot(janet_wrap_fiber(state->pending->fiber));
 
-  FREE_CALL_STATE(state);
+  filter_free(state->pending->filter);
+
+  free_callback_state(state);
 }
 
 static int signal_install_handler(sd_bus_message *msg, void *userdata,
@@ -52,12 +95,52 @@ static int signal_install_handler(sd_bus_message *msg, void *userdata,
     sd_bus_error *error = (sd_bus_error *) sd_bus_message_get_error(msg);
     JanetString str     = format_error(error);
 
+    if (pending->callback) {
+      janet_eprintf("failed to install match: %S\n", str);
+      return 0;
+    }
+
+    flush_batches(state->conn, pending->chan);
     CHAN_PUSH(pending->chan, janet_ckeywordv("error"), janet_wrap_string(str));
   }
 
   return 0;
 }
 
+// Call the callback of a match in its own fiber, which is reused as
+// long as the callback returns without yielding. Errors are printed
+// and do not cancel the match.
+static void invoke_callback(AsyncPending *pending, Janet msg) {
+  JanetFiber *fiber = pending->fiber;
+
+  Janet out;
+  JanetSignal sig = janet_pcall(pending->callback, 1, &msg, &out, &fiber);
+
+  // No fiber is created if the call itself fails
+  if (!fiber) {
+    janet_eprintf("match callback failed: %v\n", out);
+    return;
+  }
+
+  if (!pending->fiber) {
+    pending->fiber = fiber;
+    janet_gcroot(janet_wrap_fiber(fiber));
+  }
+
+  if (sig == JANET_SIGNAL_OK)
+    return;
+
+  if (sig == JANET_SIGNAL_ERROR) {
+    janet_stacktrace(fiber, out);
+    return;
+  }
+
+  // A suspended fiber belongs to whoever resumes it
+  janet_stacktrace(fiber, janet_cstringv("match callback must not yield"));
+  janet_gcunroot(janet_wrap_fiber(fiber));
+  pending->fiber = NULL;
+}
+
 static sd_bus_message *message_copy(sd_bus *bus, sd_bus_message *msg,
                                     uint8_t type) {
   sd_bus_message *new;
@@ -66,12 +149,32 @@ static sd_bus_message *message_copy(sd_bus *bus, sd_bus_message *msg,
   CALL_SD_BUS_FUNC(sd_bus_message_rewind, msg, true);
   CALL_SD_BUS_FUNC(sd_bus_message_copy, new, msg, true);
   CALL_SD_BUS_FUNC(sd_bus_message_rewind, msg, true);
+  view_cursor_reset(msg);
 
   CALL_SD_BUS_FUNC(sd_bus_message_seal, new, 0, 0);
 
   return new;
 }
 
+void deliver(Conn *conn, AsyncPending *pending, sd_bus_message *msg) {
+  sd_bus_message **msg_ptr =
+      janet_abstract(&dbus_message_type, sizeof(sd_bus_message *));
+  *msg_ptr = msg;
+
+  if (pending->callback) {
+    invoke_callback(pending, janet_wrap_abstract(msg_ptr));
+    return;
+  }
+
+  if (pending->batch) {
+    batch_push(conn, pending->chan, janet_wrap_abstract(msg_ptr));
+    return;
+  }
+
+  flush_batches(conn, pending->chan);
+  CHAN_PUSH(pending->chan, janet_ckeywordv("ok"), janet_wrap_abstract(msg_ptr));
+}
+
 static int message_handler(sd_bus_message *reply, void *userdata,
                            sd_bus_error *ret_error) {
   UNUSED(ret_error);
@@ -80,42 +183,41 @@ static int message_handler(sd_bus_message *reply, void *userdata,
   Conn *conn            = state->conn;
   AsyncPending *pending = state->pending;
 
+  // Rejected and coalesced messages never reach Janet
+  if (pending->filter && !filter_accept(pending->filter, reply))
+    return 0;
+
   uint8_t type;
   sd_bus_message_get_type(reply, &type);
 
   switch (type) {
     case SD_BUS_MESSAGE_METHOD_RETURN:
       if (pending->kind == Call)
-        dequeue_pending(&conn->queue, pending);
+        dequeue_pending(conn, pending);
     /* fallthrough */
-    case SD_BUS_MESSAGE_METHOD_CALL: {
-      sd_bus_message **msg_ptr =
-          janet_abstract(&dbus_message_type, sizeof(sd_bus_message *));
-
-      *msg_ptr = (pending->kind == Call) ? sd_bus_message_ref(reply)
-                                         : message_copy(conn->bus, reply, type);
-
-      CHAN_PUSH(pending->chan, janet_ckeywordv("ok"),
-                janet_wrap_abstract(msg_ptr));
+    case SD_BUS_MESSAGE_METHOD_CALL:
+      deliver(conn, pending,
+              (pending->kind == Call) ? sd_bus_message_ref(reply)
+                                      : message_copy(conn->bus, reply, type));
       break;
-    }
-    case SD_BUS_MESSAGE_SIGNAL: {
-      sd_bus_message **msg_ptr =
-          janet_abstract(&dbus_message_type, sizeof(sd_bus_message *));
-      *msg_ptr = sd_bus_message_ref(reply);
 
-      CHAN_PUSH(pending->chan, janet_ckeywordv("ok"),
-                janet_wrap_abstract(msg_ptr));
+    case SD_BUS_MESSAGE_SIGNAL:
+      deliver(conn, pending, sd_bus_message_ref(reply));
       break;
-    }
 
     case SD_BUS_MESSAGE_METHOD_ERROR: {
+      if (pending->callback) {
+        deliver(conn, pending, sd_bus_message_ref(reply));
+        break;
+      }
+
       if (pending->kind == Call)
-        dequeue_pending(&conn->queue, pending);
+        dequeue_pending(conn, pending);
 
       sd_bus_error *error = (sd_bus_error *) sd_bus_message_get_error(reply);
       JanetString str     = format_error(error);
 
+      flush_batches(conn, pending->chan);
       CHAN_PUSH(pending->chan, janet_ckeywordv("error"),
                 janet_wrap_string(str));
       break;
@@ -128,46 +230,131 @@ static int message_handler(sd_bus_message *reply, void *userdata,
   return 0;
 }
 
+// Parse the `chan` and `opts` arguments shared by `match-async` and
+// `become-monitor`. The callback, if any, is rooted by the caller once
+// the slot has been created.
+static AsyncState *init_match_state(Conn *conn, const Janet *argv,
+                                    int32_t argc, const char *rule) {
+  require_event_loop(conn);
+
+  bool batch = false;
+  Janet opts = janet_wrap_nil();
+  if (argc == 4 && janet_checktypes(argv[3], JANET_TFLAG_DICTIONARY)) {
+    opts  = argv[3];
+    batch = janet_truthy(janet_get(opts, janet_ckeywordv("batch")));
+  } else {
+    batch = argc == 4 && janet_truthy(argv[3]);
+  }
+
+  JanetChannel *ch        = NULL;
+  JanetFunction *callback = NULL;
+  if (janet_checktype(argv[2], JANET_FUNCTION)) {
+    callback = janet_unwrap_function(argv[2]);
+    if (callback->def->min_arity > 1 || callback->def->max_arity < 1)
+      janet_panicf("match callback must accept one argument, got %v",
+                   argv[2]);
+    if (batch)
+      janet_panic("batched delivery requires a channel");
+  } else {
+    ch = janet_getabstract(argv, 2, &janet_channel_type);
+  }
+
+  Janet limit = janet_get(opts, janet_ckeywordv("queue-limit"));
+  if (callback && !janet_checktype(limit, JANET_NIL))
+    janet_panic("queue limits require a channel");
+
+  MatchFilter *filter = NULL;
+  if (!janet_checktype(opts, JANET_NIL))
+    filter = filter_new(conn, opts, rule);
+
+  AsyncState *state        = init_callback_state(conn, ch, true);
+  state->pending->kind     = Match;
+  state->pending->batch    = batch;
+  state->pending->filter   = filter;
+  state->pending->callback = callback;
+
+  return state;
+}
+
 JANET_FN(
-    cfun_call_async, "(sdbus/call-async bus message chan &opt timeout)",
+    cfun_call_async,
+    "(sdbus/call-async bus message chan &opt timeout & args)",
     "Call a D-Bus method asynchronously with an optional timeout in "
     "microseconds. Returns a bus slot that may be passed to `sdbus/cancel` to "
     "cancel the pending call.\n\n"
+    "`message` may also be a message template, in which case `args` are "
+    "appended to a new message according to the template's body "
+    "signature. A nil `timeout` uses the default.\n\n"
     "The reply message from the asynchronous call will be written to "
     "the channel, `chan`, together with a status value as a tuple, `[status "
     "reply]`. Status will be one of :ok, :error, or :close --- the last "
     "of which indicating that the D-Bus connection was closed while the "
-    "call was pending.") {
-  janet_arity(argc, 3, 4);
+    "call was pending.\n\n"
+    "`timeout` may also be a struct with the keys `:timeout`, `:batch`, "
+    "and `:slot`. With `:batch` true, successful replies are delivered in "
+    "batches as with `sdbus/match-async`. With `:slot` false, no slot "
+    "is created for the call, which then cannot be cancelled, and nil "
+    "is returned.") {
+  janet_arity(argc, 3, -1);
+
+  JanetChannel *ch = janet_getabstract(argv, 2, &janet_channel_type);
+
+  uint64_t timeout = 0;
+  bool batch       = false;
+  bool slot        = true;
+  if (argc > 3 && janet_checktypes(argv[3], JANET_TFLAG_DICTIONARY)) {
+    Janet value = janet_get(argv[3], janet_ckeywordv("timeout"));
+    if (!janet_checktype(value, JANET_NIL))
+      timeout = janet_getinteger64(&value, 0);
+
+    batch = janet_truthy(janet_get(argv[3], janet_ckeywordv("batch")));
+
+    value = janet_get(argv[3], janet_ckeywordv("slot"));
+    slot  = janet_checktype(value, JANET_NIL) || janet_truthy(value);
+  } else {
+    timeout = janet_optinteger64(argv, argc, 3, 0);
+  }
 
-  Conn *conn               = janet_getabstract(argv, 0, &dbus_bus_type);
-  sd_bus_message **msg_ptr = janet_getabstract(argv, 1, &dbus_message_type);
-  JanetChannel *ch         = janet_getabstract(argv, 2, &janet_channel_type);
-  uint64_t timeout         = janet_optinteger64(argv, argc, 3, 0);
+  int32_t nargs            = (argc > 4) ? argc - 4 : 0;
+  sd_bus_message **msg_ptr = get_message(argv, 1, argv + 4, nargs);
+  Conn *conn               = pool_conn_for(argv, 0, *msg_ptr);
 
-  AsyncState *state    = init_callback_state(conn, ch);
-  state->pending->kind = Call;
+  AsyncState *state     = init_callback_state(conn, ch, slot);
+  state->pending->kind  = Call;
+  state->pending->batch = batch;
 
-  int rv = sd_bus_call_async(conn->bus, state->pending->slot, *msg_ptr,
-                             message_handler, state, timeout);
+  sd_bus_slot *call_slot;
+  int rv = sd_bus_call_async(conn->bus, &call_slot, *msg_ptr, message_handler,
+                             state, timeout);
   if (rv < 0) {
-    FREE_CALL_STATE(state);
+    free_callback_state(state);
     janet_panicf("failed to call sd_bus_call_async: %s", strerror(-rv));
   }
 
-  sd_bus_slot_set_floating(*state->pending->slot, 1);
+  sd_bus_slot_set_floating(call_slot, 1);
+  state->pending->bus_slot = call_slot;
 
-  queue_pending(&conn->queue, state->pending);
-  sd_bus_slot_set_destroy_callback(*state->pending->slot,
-                                   destroy_call_callback);
+  queue_pending(conn, state->pending);
+  sd_bus_slot_set_destroy_callback(call_slot, destroy_call_callback);
 
+  // The reply may be dispatched by settimeout, after which the state
+  // can already have been recycled
+  Janet result = janet_wrap_nil();
+  if (state->pending->slot) {
+    *state->pending->slot = call_slot;
+    result                = janet_wrap_abstract(state->pending->slot);
+  } else {
+    sd_bus_slot_unref(call_slot);
+  }
+
+  capture_message(*msg_ptr);
   settimeout(conn);
 
-  return janet_wrap_abstract(state->pending->slot);
+  return result;
 }
 
 JANET_FN(
-    cfun_match_async, "(sdbus/match-async bus rule chan)",
+    cfun_match_async, "(sdbus/match-async bus rule chan &opt opts)",
     "Subscribe to D-Bus messages that match a rule string. Returns a bus slot "
     "that may be passed to `sdbus/cancel` to unsubscribe.\n\n"
     "The rule string must conform to the D-Bus specification on Match Rules. "
@@ -175,34 +362,565 @@ JANET_FN(
     "Matching messages are written to the channel, `chan`, together with a "
     "status value as a tuple, `[status msg]`. Status will be one of :ok, "
     ":error, or :close --- the last of which indicates that the D-Bus "
-    "connection has been closed.\n\n") {
-  janet_fixarity(argc, 3);
+    "connection has been closed.\n\n"
+    "If `opts` is true, or a struct with `:batch` true, all matching "
+    "messages dispatched in one pass "
+    "over the connection are instead written together as a single "
+    "`[:ok msgs]` tuple, where `msgs` is an array of messages. This "
+    "saves a channel handoff per message during bursts of signals.\n\n"
+    "`chan` may instead be a function, which is called with each "
+    "matching message as soon as it is dispatched, without a channel "
+    "or a fiber switch per message. The function must not yield. Errors "
+    "raised by the function are printed and the match remains "
+    "installed.\n\n"
+    "`opts` may also filter messages before they are decoded or "
+    "delivered, for conditions a match rule cannot express:\n\n"
+    "* `:args` --- a struct mapping argument indices to a string or "
+    "number which the argument must equal\n"
+    "* `:arg-prefix` --- a struct mapping argument indices to a string "
+    "prefix of the argument\n"
+    "* `:path` --- a glob, as with `fnmatch`, matching the object path\n"
+    "* `:sample` --- deliver only every nth message passing the other "
+    "conditions\n"
+    "* `:coalesce` --- a window in seconds. The first signal for a key "
+    "opens the window, later signals replace it, and only the latest is "
+    "delivered once the window closes.\n"
+    "* `:coalesce-by` --- the key for coalescing, one of `:path`, "
+    "`:interface`, the default, or `:member`, each including the "
+    "preceding header fields\n"
+    "* `:queue-limit` --- the number of items `chan` may hold before "
+    "the `:overflow` policy applies\n"
+    "* `:overflow` --- one of `:drop-oldest`, the default, which "
+    "discards the oldest item in the channel, `:drop-newest`, which "
+    "discards the new message, `:coalesce`, which holds the latest "
+    "signal per `:coalesce-by` key until the channel has room, or "
+    "`:pause`, which removes the match from the bus until the channel "
+    "is half empty\n\n"
+    "Channels do not report when items are taken, so while messages are "
+    "held by `:coalesce` or the match is paused the channel is checked "
+    "every 10 ms.\n\n"
+    "See `sdbus/match-stats` for counters of filtered messages.") {
+  janet_arity(argc, 3, 4);
 
-  Conn *conn        = janet_getabstract(argv, 0, &dbus_bus_type);
+  Conn *conn        = getconn(argv, 0);
   const char *match = janet_getcstring(argv, 1);
-  JanetChannel *ch  = janet_getabstract(argv, 2, &janet_channel_type);
 
-  AsyncState *state    = init_callback_state(conn, ch);
-  state->pending->kind = Match;
+  AsyncState *state = init_match_state(conn, argv, argc, match);
+  MatchFilter *filter = state->pending->filter;
 
   int rv =
       sd_bus_add_match_async(conn->bus, state->pending->slot, match,
                              message_handler, signal_install_handler, state);
 
   if (rv < 0) {
-    FREE_CALL_STATE(state);
+    filter_free(filter);
+    free_callback_state(state);
     janet_panicf("failed to call sd_bus_add_match_async: %s", strerror(-rv));
   }
 
+  if (filter)
+    filter_attach(filter, state->pending);
+
   sd_bus_slot_set_floating(*state->pending->slot, 1);
+  state->pending->bus_slot = *state->pending->slot;
+
+  if (state->pending->callback)
+    janet_gcroot(janet_wrap_function(state->pending->callback));
 
-  queue_pending(&conn->queue, state->pending);
+  queue_pending(conn, state->pending);
   sd_bus_slot_set_destroy_callback(*state->pending->slot,
                                    destroy_call_callback);
 
   return janet_wrap_abstract(state->pending->slot);
 }
 
+// Filter consuming all messages received by a monitor connection, so
+// that sd-bus neither copies nor replies to method calls addressed to
+// other peers
+static int monitor_handler(sd_bus_message *msg, void *userdata,
+                           sd_bus_error *ret_error) {
+  UNUSED(ret_error);
+
+  AsyncState *state     = userdata;
+  Conn *conn            = state->conn;
+  AsyncPending *pending = state->pending;
+
+  // Until the reply to BecomeMonitor, messages are ordinary traffic
+  if (pending->cookie) {
+    uint64_t cookie;
+    if (sd_bus_message_get_reply_cookie(msg, &cookie) < 0 ||
+        cookie != pending->cookie)
+      return 0;
+
+    pending->cookie = 0;
+    if (sd_bus_message_is_method_error(msg, NULL)) {
+      signal_install_handler(msg, state, ret_error);
+
+      // The connection remains an ordinary peer, so stop consuming its
+      // messages. sd-bus holds a reference to the running slot, so the
+      // state is only destroyed once this handler returns.
+      sd_bus_slot_set_floating(*pending->slot, 0);
+      sd_bus_slot_unrefp(pending->slot);
+      *pending->slot = NULL;
+    }
+
+    return 1;
+  }
+
+  if (pending->filter && !filter_accept(pending->filter, msg))
+    return 1;
+
+  deliver(conn, pending, sd_bus_message_ref(msg));
+  return 1;
+}
+
+static sd_bus_message *new_monitor_call(sd_bus *bus, const Janet *rules,
+                                        int32_t n) {
+  sd_bus_message *msg;
+  CALL_SD_BUS_FUNC(sd_bus_message_new_method_call, bus, &msg,
+                   "org.freedesktop.DBus", "/org/freedesktop/DBus",
+                   "org.freedesktop.DBus.Monitoring", "BecomeMonitor");
+
+  CALL_SD_BUS_FUNC(sd_bus_message_open_container, msg, 'a', "s");
+  for (int32_t i = 0; i < n; i++)
+    CALL_SD_BUS_FUNC(sd_bus_message_append_basic, msg, 's',
+                     janet_unwrap_string(rules[i]));
+  CALL_SD_BUS_FUNC(sd_bus_message_close_container, msg);
+
+  CALL_SD_BUS_FUNC(sd_bus_message_append_basic, msg, 'u', &(uint32_t) { 0 });
+  CALL_SD_BUS_FUNC(sd_bus_message_seal, msg, 0, 0);
+
+  return msg;
+}
+
+JANET_FN(
+    cfun_become_monitor, "(sdbus/become-monitor bus rules chan &opt opts)",
+    "Turn a bus connection into a monitor receiving every message on "
+    "the bus that matches one of the match rule strings in `rules`, or "
+    "all messages if `rules` is empty or nil. Returns a bus slot.\n\n"
+    "Messages are written to `chan`, or passed to a function, as with "
+    "`sdbus/match-async`, including method calls addressed to other "
+    "peers, which are delivered by reference rather than copied. "
+    "`opts` accepts the same batching, filtering, and queue limit "
+    "options, except for the `:pause` overflow policy. An `[:error "
+    "err]` tuple is written if the bus refuses the request, in which "
+    "case the slot is released and the connection stays an ordinary "
+    "peer.\n\n"
+    "A monitor connection may no longer send messages, and the bus "
+    "disconnects it if it tries, so a dedicated connection should be "
+    "opened for monitoring and only be closed afterwards.") {
+  janet_arity(argc, 3, 4);
+
+  Conn *conn = janet_getabstract(argv, 0, &dbus_bus_type);
+
+  const Janet *rules = NULL;
+  int32_t nrules     = 0;
+  if (!janet_checktype(argv[1], JANET_NIL)) {
+    JanetView view = janet_getindexed(argv, 1);
+    rules  = view.items;
+    nrules = view.len;
+
+    for (int32_t i = 0; i < nrules; i++) {
+      if (!janet_checktype(rules[i], JANET_STRING))
+        janet_panicf("expected match rule string, got %v", rules[i]);
+    }
+  }
+
+  AsyncState *state = init_match_state(conn, argv, argc, NULL);
+
+  sd_bus_message *msg = new_monitor_call(conn->bus, rules, nrules);
+
+  // The filter is installed first, so that the connection is never a
+  // monitor without it. Nothing is dispatched before the cookie is set.
+  uint64_t cookie;
+  int rv = sd_bus_add_filter(conn->bus, state->pending->slot, monitor_handler,
+                             state);
+  if (rv >= 0) {
+    rv = sd_bus_send(conn->bus, msg, &cookie);
+    if (rv < 0) {
+      sd_bus_slot_unrefp(state->pending->slot);
+      *state->pending->slot = NULL;
+    }
+  }
+
+  if (rv < 0) {
+    sd_bus_message_unref(msg);
+    filter_free(state->pending->filter);
+    free_callback_state(state);
+    janet_panicf("failed to become monitor: %s", strerror(-rv));
+  }
+
+  state->pending->cookie = cookie;
+  if (state->pending->filter)
+    filter_attach(state->pending->filter, state->pending);
+
+  sd_bus_slot_set_floating(*state->pending->slot, 1);
+  state->pending->bus_slot = *state->pending->slot;
+
+  if (state->pending->callback)
+    janet_gcroot(janet_wrap_function(state->pending->callback));
+
+  queue_pending(conn, state->pending);
+  sd_bus_slot_set_destroy_callback(*state->pending->slot,
+                                   destroy_call_callback);
+
+  // A refusal dispatched by settimeout releases the state
+  Janet result = janet_wrap_abstract(state->pending->slot);
+
+  capture_message(msg);
+  sd_bus_message_unref(msg);
+  settimeout(conn);
+
+  return result;
+}
+
+// Method calls sent together by `call-many-async`. A single pending
+// entry represents the group on the connection, and replies are
+// collected in order until the last one arrives.
+typedef struct CallGroup {
+  Conn *conn;
+  AsyncPending *pending;
+  JanetArray *results;  // `[status value]` per call, rooted until complete
+  int32_t remaining;    // Replies outstanding
+  int32_t refs;         // Member slots alive
+  int32_t count;        // Number of calls
+  sd_bus_slot *slots[]; // Floating member slots, NULL once destroyed
+} CallGroup;
+
+typedef struct {
+  CallGroup *group;
+  int32_t index;
+} GroupMember;
+
+static void group_result(CallGroup *group, int32_t index, Janet status,
+                         Janet value) {
+  group->results->data[index] = janet_wrap_tuple(TUPLE(status, value));
+  settle_calls(group->conn, group->pending, 1);
+  if (--group->remaining > 0)
+    return;
+
+  dequeue_pending(group->conn, group->pending);
+  CHAN_PUSH(group->pending->chan, janet_ckeywordv("ok"),
+            janet_wrap_array(group->results));
+
+  janet_gcunroot(janet_wrap_array(group->results));
+  group->results = NULL;
+}
+
+static void group_release(CallGroup *group) {
+  if (--group->refs > 0)
+    return;
+
+  if (group->results) {
+    dequeue_pending(group->conn, group->pending);
+    janet_gcunroot(janet_wrap_array(group->results));
+  }
+
+  janet_free(group->pending);
+  janet_free(group);
+}
+
+static int group_handler(sd_bus_message *reply, void *userdata,
+                         sd_bus_error *ret_error) {
+  UNUSED(ret_error);
+
+  GroupMember *member = userdata;
+  if (sd_bus_message_is_method_error(reply, NULL)) {
+    sd_bus_error *error = (sd_bus_error *) sd_bus_message_get_error(reply);
+    group_result(member->group, member->index, janet_ckeywordv("error"),
+                 janet_wrap_string(format_error(error)));
+    return 0;
+  }
+
+  sd_bus_message **msg_ptr =
+      janet_abstract(&dbus_message_type, sizeof(sd_bus_message *));
+  *msg_ptr = sd_bus_message_ref(reply);
+
+  group_result(member->group, member->index, janet_ckeywordv("ok"),
+               janet_wrap_abstract(msg_ptr));
+  return 0;
+}
+
+static void destroy_group_member(void *userdata) {
+  GroupMember *member                 = userdata;
+  member->group->slots[member->index] = NULL;
+  group_release(member->group);
+  janet_free(member);
+}
+
+// Disconnect the member slots of a group whose connection is closed
+void group_disconnect(CallGroup *group) {
+  group->refs++;
+  for (int32_t i = 0; i < group->count; i++) {
+    if (group->slots[i])
+      sd_bus_slot_set_floating(group->slots[i], 0);
+  }
+  group_release(group);
+}
+
+// Build the message for one entry of `calls`, either a message created
+// on `conn` or a `[destination path interface member signature & args]`
+// tuple. Returns the wrapped message.
+static Janet many_message(Conn *conn, Janet call, bool no_reply) {
+  sd_bus_message **msg_ptr = janet_checkabstract(call, &dbus_message_type);
+  if (msg_ptr) {
+    // Sealed messages cannot be changed, and others belong to the caller
+    if (no_reply)
+      janet_panic("messages cannot be sent without a reply, use a tuple");
+
+    if (sd_bus_message_get_bus(*msg_ptr) != conn->bus)
+      janet_panic("message was not created on this connection");
+
+    return call;
+  }
+
+  JanetView spec = janet_getindexed(&call, 0);
+  if (spec.len < 4)
+    janet_panicf("expected [destination path interface member & args], "
+                 "got %v",
+                 call);
+
+  const char *str[4];
+  for (int32_t i = 0; i < 4; i++)
+    str[i] = janet_getcstring(spec.items, i);
+
+  sd_bus_message *msg;
+  CALL_SD_BUS_FUNC(sd_bus_message_new_method_call, conn->bus, &msg, str[0],
+                   str[1], str[2], str[3]);
+
+  // Owned by the GC so that a failure to append does not leak
+  msg_ptr  = janet_abstract(&dbus_message_type, sizeof(sd_bus_message *));
+  *msg_ptr = msg;
+
+  if (spec.len > 4 && !janet_checktype(spec.items[4], JANET_NIL)) {
+    const Signature *signature = getsignature(spec.items, 4);
+    append_data(msg, signature, (Janet *) spec.items + 5, spec.len - 5);
+  } else if (spec.len > 5) {
+    janet_panic("expected signature for method call arguments");
+  }
+
+  if (no_reply)
+    CALL_SD_BUS_FUNC(sd_bus_message_set_expect_reply, msg, 0);
+
+  return janet_wrap_abstract(msg_ptr);
+}
+
+// Build every message before sending any, so that an invalid entry
+// fails the whole batch. Appending arguments may run Janet code, so
+// the messages are kept in a rooted array until they have been sent.
+static JanetArray *many_messages(Conn *conn, JanetView calls, bool no_reply) {
+  JanetArray *msgs = janet_array(calls.len);
+  janet_gcroot(janet_wrap_array(msgs));
+
+  JanetTryState state;
+  JanetSignal signal = janet_try(&state);
+  if (!signal) {
+    for (int32_t i = 0; i < calls.len; i++)
+      janet_array_push(msgs, many_message(conn, calls.items[i], no_reply));
+  }
+
+  janet_restore(&state);
+  if (signal) {
+    janet_gcunroot(janet_wrap_array(msgs));
+    janet_panicv(state.payload);
+  }
+
+  return msgs;
+}
+
+#define MANY_MSG(msgs, i)                                                      \
+  (*(sd_bus_message **) janet_unwrap_abstract((msgs)->data[i]))
+
+JANET_FN(
+    cfun_call_many_async, "(sdbus/call-many-async bus calls chan &opt opts)",
+    "Send several method calls at once. Each entry of `calls` is either "
+    "a method call message created on `bus`, or a tuple `[destination "
+    "path interface member signature & args]` from which one is "
+    "built. On a connection pool, all calls are sent on one connection, "
+    "which is the one that created any messages among `calls`.\n\n"
+    "All calls are queued before the connection is polled for replies. "
+    "Once every reply has arrived, `[:ok results]` is written to `chan`, "
+    "where `results` is an array holding a `[status reply]` tuple for "
+    "each call in order, with status `:ok` or `:error`. `[:close err]` "
+    "is written instead if the connection is closed first.\n\n"
+    "`opts` is a struct with the keys `:timeout`, in microseconds, and "
+    "`:no-reply`. With `:no-reply` true, the calls are sent without "
+    "expecting a reply, nothing is written to `chan`, which may be "
+    "nil, and no state is kept for them. Calls must then be given as "
+    "tuples.\n\n"
+    "Returns the number of calls sent.") {
+  janet_arity(argc, 3, 4);
+
+  JanetView calls  = janet_getindexed(argv, 1);
+  uint64_t timeout = 0;
+  bool no_reply    = false;
+  if (argc == 4 && !janet_checktype(argv[3], JANET_NIL)) {
+    if (!janet_checktypes(argv[3], JANET_TFLAG_DICTIONARY))
+      janet_panicf("expected options struct, got %v", argv[3]);
+
+    Janet value = janet_get(argv[3], janet_ckeywordv("timeout"));
+    if (!janet_checktype(value, JANET_NIL))
+      timeout = janet_getinteger64(&value, 0);
+
+    no_reply = janet_truthy(janet_get(argv[3], janet_ckeywordv("no-reply")));
+  }
+
+  JanetChannel *ch = NULL;
+  if (!no_reply || !janet_checktype(argv[2], JANET_NIL))
+    ch = janet_getabstract(argv, 2, &janet_channel_type);
+
+  // On a pool, prebuilt messages must be sent on the connection that
+  // created them
+  Conn *conn = NULL;
+  for (int32_t i = 0; i < calls.len && !conn; i++) {
+    sd_bus_message **msg_ptr =
+        janet_checkabstract(calls.items[i], &dbus_message_type);
+    if (msg_ptr)
+      conn = pool_conn_for(argv, 0, *msg_ptr);
+  }
+
+  if (!conn)
+    conn = getconn(argv, 0);
+
+  if (!no_reply)
+    require_event_loop(conn);
+
+  if (calls.len == 0) {
+    if (!no_reply)
+      CHAN_PUSH(ch, janet_ckeywordv("ok"), janet_wrap_array(janet_array(0)));
+    return janet_wrap_integer(0);
+  }
+
+  JanetArray *msgs = many_messages(conn, calls, no_reply);
+
+  if (no_reply) {
+    // Calls sent before a failing one are already queued, so the
+    // connection is polled to flush them either way
+    JanetTryState state;
+    JanetSignal signal = janet_try(&state);
+    if (!signal) {
+      for (int32_t i = 0; i < calls.len; i++) {
+        CALL_SD_BUS_FUNC(sd_bus_send, conn->bus, MANY_MSG(msgs, i), NULL);
+        capture_message(MANY_MSG(msgs, i));
+      }
+    }
+
+    janet_restore(&state);
+    janet_gcunroot(janet_wrap_array(msgs));
+    setevents(conn);
+    settimeout(conn);
+    if (signal)
+      janet_panicv(state.payload);
+
+    return janet_wrap_integer(calls.len);
+  }
+
+  CallGroup *group;
+  size_t size = sizeof(CallGroup) + calls.len * sizeof(sd_bus_slot *);
+  if (!(group = janet_malloc(size)))
+    JANET_OUT_OF_MEMORY;
+
+  *group = (CallGroup) { .conn      = conn,
+                         .pending   = create_async_pending(ch),
+                         .results   = janet_array(calls.len),
+                         .remaining = calls.len,
+                         .refs      = 1,
+                         .count     = calls.len };
+  for (int32_t i = 0; i < calls.len; i++)
+    group->slots[i] = NULL;
+
+  // The group counts as one pending call per reply still outstanding
+  group->pending->kind  = Call;
+  group->pending->calls = calls.len;
+  group->pending->group = group;
+  janet_gcroot(janet_wrap_array(group->results));
+  for (int32_t i = 0; i < calls.len; i++)
+    janet_array_push(group->results, janet_wrap_nil());
+
+  queue_pending(conn, group->pending);
+
+  for (int32_t i = 0; i < calls.len; i++) {
+    GroupMember *member;
+    if (!(member = janet_malloc(sizeof(GroupMember))))
+      JANET_OUT_OF_MEMORY;
+    *member = (GroupMember) { .group = group, .index = i };
+
+    sd_bus_slot *slot;
+    int rv = sd_bus_call_async(conn->bus, &slot, MANY_MSG(msgs, i),
+                               group_handler, member, timeout);
+    if (rv < 0) {
+      janet_free(member);
+      group_result(group, i, janet_ckeywordv("error"),
+                   janet_wrap_string(janet_formatc(
+                       "failed to call sd_bus_call_async: %s", strerror(-rv))));
+      continue;
+    }
+
+    group->refs++;
+    group->slots[i] = slot;
+    sd_bus_slot_set_floating(slot, 1);
+    sd_bus_slot_set_destroy_callback(slot, destroy_group_member);
+    sd_bus_slot_unref(slot);
+
+    capture_message(MANY_MSG(msgs, i));
+  }
+
+  janet_gcunroot(janet_wrap_array(msgs));
+  group_release(group);
+
+  setevents(conn);
+  settimeout(conn);
+
+  return janet_wrap_integer(calls.len);
+}
+
+JANET_FN(
+    cfun_call_sync, "(sdbus/call-sync bus message &opt timeout & args)",
+    "Call a D-Bus method and block until the reply arrives or `timeout`, "
+    "in microseconds, expires. Returns the contents of the reply as "
+    "with `(sdbus/message-read reply :all)`, or raises an error if the "
+    "call fails. `message` and `args` are the same as for "
+    "`sdbus/call-async`.\n\n"
+    "The whole process is blocked while waiting, including the event "
+    "loop. This is intended for short-lived programs, usually on a "
+    "connection opened as blocking, which skips the setup of event loop "
+    "listeners.") {
+  janet_arity(argc, 2, -1);
+
+  uint64_t timeout         = janet_optinteger64(argv, argc, 2, 0);
+  int32_t nargs            = (argc > 3) ? argc - 3 : 0;
+  sd_bus_message **msg_ptr = get_message(argv, 1, argv + 3, nargs);
+  Conn *conn               = pool_conn_for(argv, 0, *msg_ptr);
+
+  sd_bus_error error    = SD_BUS_ERROR_NULL;
+  sd_bus_message *reply = NULL;
+  int rv = sd_bus_call(conn->bus, *msg_ptr, timeout, &error, &reply);
+  capture_message(*msg_ptr);
+
+  // Messages read while waiting are dispatched by the event loop
+  setevents(conn);
+  settimeout(conn);
+
+  if (rv < 0) {
+    JanetString str =
+        sd_bus_error_is_set(&error)
+            ? format_error(&error)
+            : janet_formatc("failed to call sd_bus_call: %s", strerror(-rv));
+    sd_bus_error_free(&error);
+    janet_panicv(janet_wrap_string(str));
+  }
+
+  // Owned by the GC so that a failure to decode does not leak
+  sd_bus_message **reply_ptr =
+      janet_abstract(&dbus_message_type, sizeof(sd_bus_message *));
+  *reply_ptr = reply;
+
+  return read_items(reply, 0, true, -1);
+}
+
 JanetRegExt cfuns_call[] = { JANET_REG("call-async", cfun_call_async),
                              JANET_REG("match-async", cfun_match_async),
+                             JANET_REG("become-monitor", cfun_become_monitor),
+                             JANET_REG("call-many-async", cfun_call_many_async),
+                             JANET_REG("call-sync", cfun_call_sync),
                              JANET_REG_END };
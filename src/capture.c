@@ -0,0 +1,739 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Joshua Krusell
+
+#include "common.h"
+
+// Classic pcap file format with the D-Bus link type, as produced by
+// `busctl capture` and understood by Wireshark
+#define PCAP_MAGIC   0xa1b2c3d4
+#define PCAP_SNAPLEN (128 * 1024 * 1024)
+#define DLT_DBUS     231
+
+// Default limit on buffered capture data not yet taken by a writer
+#define CAPTURE_DEFAULT_LIMIT (64 * 1024 * 1024)
+
+// D-Bus message header flags and fields
+#define FLAG_NO_REPLY_EXPECTED 0x1
+#define FLAG_NO_AUTO_START     0x2
+#define FLAG_ALLOW_INTERACTIVE 0x4
+
+enum {
+  FIELD_PATH = 1,
+  FIELD_INTERFACE,
+  FIELD_MEMBER,
+  FIELD_ERROR_NAME,
+  FIELD_REPLY_SERIAL,
+  FIELD_DESTINATION,
+  FIELD_SENDER,
+  FIELD_SIGNATURE,
+  FIELD_UNIX_FDS
+};
+
+// Maximum signature length per the D-Bus specification
+#define SIGNATURE_MAX_LEN 255
+
+#define TRY(expr)                                                              \
+  do {                                                                         \
+    int _rv = (expr);                                                          \
+    if (_rv < 0)                                                               \
+      return _rv;                                                              \
+  } while (0)
+
+// Connections with an active capture, searched when sending messages
+static JANET_THREAD_LOCAL Capture *g_captures;
+
+// Scratch buffers reused for serializing each captured message
+static JANET_THREAD_LOCAL JanetBuffer g_header, g_body;
+
+static int type_alignment(char type) {
+  switch (type) {
+    case SD_BUS_TYPE_BYTE:
+    case SD_BUS_TYPE_SIGNATURE:
+    case SD_BUS_TYPE_VARIANT:
+      return 1;
+    case SD_BUS_TYPE_INT16:
+    case SD_BUS_TYPE_UINT16:
+      return 2;
+    case SD_BUS_TYPE_INT64:
+    case SD_BUS_TYPE_UINT64:
+    case SD_BUS_TYPE_DOUBLE:
+    case SD_BUS_TYPE_STRUCT:
+    case SD_BUS_TYPE_STRUCT_BEGIN:
+    case SD_BUS_TYPE_DICT_ENTRY:
+    case SD_BUS_TYPE_DICT_ENTRY_BEGIN:
+      return 8;
+    default:
+      return 4;
+  }
+}
+
+static void pad(JanetBuffer *buffer, int align) {
+  while (buffer->count % align)
+    janet_buffer_push_u8(buffer, 0);
+}
+
+static void push_aligned(JanetBuffer *buffer, const void *data, int32_t size) {
+  pad(buffer, size);
+  janet_buffer_push_bytes(buffer, data, size);
+}
+
+static void push_string(JanetBuffer *buffer, char type, const char *str) {
+  size_t len = strlen(str);
+  if (type == SD_BUS_TYPE_SIGNATURE) {
+    janet_buffer_push_u8(buffer, (uint8_t) len);
+  } else {
+    uint32_t n = (uint32_t) len;
+    push_aligned(buffer, &n, sizeof(n));
+  }
+
+  janet_buffer_push_bytes(buffer, (const uint8_t *) str, (int32_t) len + 1);
+}
+
+// Serialize the message contents at the read cursor in native byte
+// order. Alignment is relative to the start of the body, which is
+// itself 8-byte aligned within the message.
+static int marshal_contents(sd_bus_message *msg, JanetBuffer *out,
+                            uint32_t *nfds) {
+  char type;
+  const char *contents = NULL;
+  int rv;
+  while ((rv = sd_bus_message_peek_type(msg, &type, &contents)) > 0) {
+    if (is_basic_type(type)) {
+      union {
+        uint8_t u8;
+        uint16_t u16;
+        uint32_t u32;
+        uint64_t u64;
+        const char *str;
+        int fd;
+      } value;
+
+      TRY(sd_bus_message_read_basic(msg, type, &value));
+      switch (type) {
+        case SD_BUS_TYPE_STRING:
+        case SD_BUS_TYPE_OBJECT_PATH:
+        case SD_BUS_TYPE_SIGNATURE:
+          push_string(out, type, value.str);
+          break;
+        case SD_BUS_TYPE_UNIX_FD: {
+          // File descriptors are sent out-of-band, the body holds an index
+          uint32_t index = (*nfds)++;
+          push_aligned(out, &index, sizeof(index));
+          break;
+        }
+        case SD_BUS_TYPE_BOOLEAN:
+          push_aligned(out, &value.u32, sizeof(uint32_t));
+          break;
+        default:
+          push_aligned(out, &value, (int32_t) fixed_type_size(type));
+      }
+
+      continue;
+    }
+
+    if (type == SD_BUS_TYPE_VARIANT)
+      push_string(out, SD_BUS_TYPE_SIGNATURE, contents);
+    else
+      pad(out, type_alignment(type));
+
+    int32_t length_at = 0, start = 0;
+    if (type == SD_BUS_TYPE_ARRAY) {
+      uint32_t placeholder = 0;
+      push_aligned(out, &placeholder, sizeof(placeholder));
+
+      length_at = out->count - 4;
+      pad(out, type_alignment(contents[0]));
+      start = out->count;
+
+      // Fixed-width arrays are laid out the same as in memory
+      if (fixed_type_size(contents[0]) && contents[1] == '\0') {
+        const void *ptr = NULL;
+        size_t size     = 0;
+        TRY(sd_bus_message_read_array(msg, contents[0], &ptr, &size));
+
+        janet_buffer_push_bytes(out, ptr, (int32_t) size);
+        memcpy(out->data + length_at, &(uint32_t) { size }, 4);
+        continue;
+      }
+    }
+
+    TRY(sd_bus_message_enter_container(msg, type, contents));
+    TRY(marshal_contents(msg, out, nfds));
+    TRY(sd_bus_message_exit_container(msg));
+
+    if (type == SD_BUS_TYPE_ARRAY) {
+      uint32_t size = (uint32_t) (out->count - start);
+      memcpy(out->data + length_at, &size, sizeof(size));
+    }
+  }
+
+  return rv;
+}
+
+static void push_field(JanetBuffer *out, uint8_t code, char type,
+                       const void *value) {
+  if (!value)
+    return;
+
+  pad(out, 8);
+  janet_buffer_push_u8(out, code);
+  janet_buffer_push_bytes(out, (const uint8_t[]) { 1, type, 0 }, 3);
+
+  if (type == SD_BUS_TYPE_UINT32)
+    push_aligned(out, value, sizeof(uint32_t));
+  else
+    push_string(out, type, value);
+}
+
+// Serialize a sealed message to D-Bus wire format in `g_header`
+// followed by `g_body`
+static int marshal_message(sd_bus_message *msg) {
+  g_header.count = 0;
+  g_body.count   = 0;
+
+  uint32_t nfds = 0;
+  TRY(sd_bus_message_rewind(msg, true));
+  TRY(marshal_contents(msg, &g_body, &nfds));
+  TRY(sd_bus_message_rewind(msg, true));
+
+  uint8_t type;
+  uint64_t cookie = 0, reply_cookie = 0;
+  TRY(sd_bus_message_get_type(msg, &type));
+  TRY(sd_bus_message_get_cookie(msg, &cookie));
+  sd_bus_message_get_reply_cookie(msg, &reply_cookie);
+
+  uint8_t flags = 0;
+  if (type == SD_BUS_MESSAGE_METHOD_CALL &&
+      !sd_bus_message_get_expect_reply(msg))
+    flags |= FLAG_NO_REPLY_EXPECTED;
+  if (!sd_bus_message_get_auto_start(msg))
+    flags |= FLAG_NO_AUTO_START;
+  if (sd_bus_message_get_allow_interactive_authorization(msg) > 0)
+    flags |= FLAG_ALLOW_INTERACTIVE;
+
+  const uint16_t probe = 1;
+  uint8_t endian       = (*(const uint8_t *) &probe) ? 'l' : 'B';
+
+  JanetBuffer *out = &g_header;
+  janet_buffer_push_bytes(out, (const uint8_t[]) { endian, type, flags, 1 }, 4);
+  janet_buffer_push_bytes(out, (const uint8_t *) &(uint32_t) { g_body.count },
+                          4);
+  janet_buffer_push_bytes(out, (const uint8_t *) &(uint32_t) { cookie }, 4);
+
+  // Header field array length is filled in afterwards
+  janet_buffer_push_bytes(out, (const uint8_t[]) { 0, 0, 0, 0 }, 4);
+
+  const sd_bus_error *error = sd_bus_message_get_error(msg);
+  const char *signature     = sd_bus_message_get_signature(msg, true);
+  uint32_t reply_serial     = (uint32_t) reply_cookie;
+
+  push_field(out, FIELD_PATH, 'o', sd_bus_message_get_path(msg));
+  push_field(out, FIELD_INTERFACE, 's', sd_bus_message_get_interface(msg));
+  push_field(out, FIELD_MEMBER, 's', sd_bus_message_get_member(msg));
+  push_field(out, FIELD_ERROR_NAME, 's', error ? error->name : NULL);
+  push_field(out, FIELD_REPLY_SERIAL, 'u', reply_cookie ? &reply_serial : NULL);
+  push_field(out, FIELD_DESTINATION, 's', sd_bus_message_get_destination(msg));
+  push_field(out, FIELD_SENDER, 's', sd_bus_message_get_sender(msg));
+  push_field(out, FIELD_SIGNATURE, 'g', *signature ? signature : NULL);
+  push_field(out, FIELD_UNIX_FDS, 'u', nfds ? &nfds : NULL);
+
+  uint32_t fields_len = (uint32_t) (out->count - 16);
+  memcpy(out->data + 12, &fields_len, sizeof(fields_len));
+  pad(out, 8);
+
+  return 0;
+}
+
+// Append a pcap record for `msg` to the capture buffer. Errors are
+// counted as dropped messages since this runs within sd-bus callbacks.
+static void capture_record(Capture *capture, sd_bus_message *msg) {
+  // Marshalling moves the read cursor of the message
+  view_cursor_reset(msg);
+
+  if (marshal_message(msg) < 0) {
+    capture->dropped++;
+    return;
+  }
+
+  uint32_t len = (uint32_t) (g_header.count + g_body.count);
+  if ((size_t) capture->buffer->count + len + 16 > capture->limit) {
+    capture->dropped++;
+    return;
+  }
+
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+  uint32_t record[4] = { (uint32_t) ts.tv_sec, (uint32_t) (ts.tv_nsec / 1000),
+                         len, len };
+  janet_buffer_push_bytes(capture->buffer, (const uint8_t *) record,
+                          sizeof(record));
+  janet_buffer_push_bytes(capture->buffer, g_header.data, g_header.count);
+  janet_buffer_push_bytes(capture->buffer, g_body.data, g_body.count);
+
+  capture->captured++;
+}
+
+static int capture_filter(sd_bus_message *msg, void *userdata,
+                          sd_bus_error *ret_error) {
+  UNUSED(ret_error);
+
+  Capture *capture = userdata;
+  capture_record(capture, msg);
+
+  return 0;
+}
+
+void capture_message(sd_bus_message *msg) {
+  if (!g_captures)
+    return;
+
+  sd_bus *bus = sd_bus_message_get_bus(msg);
+  for (Capture *c = g_captures; c; c = c->next) {
+    if (c->filter && c->conn->bus == bus) {
+      capture_record(c, msg);
+      return;
+    }
+  }
+}
+
+// Maximum nesting of variants when decoding wire messages
+#define WIRE_MAX_DEPTH 64
+
+// Read state over a message in D-Bus wire format
+typedef struct {
+  const uint8_t *data;
+  size_t len;
+  size_t pos;
+  bool swap; // Message byte order differs from ours
+} Wire;
+
+static int wire_align(Wire *w, size_t align) {
+  size_t pos = (w->pos + align - 1) & ~(align - 1);
+  if (pos > w->len)
+    return -EBADMSG;
+
+  w->pos = pos;
+  return 0;
+}
+
+static int wire_read(Wire *w, void *out, size_t size) {
+  TRY(wire_align(w, size));
+  if (w->len - w->pos < size)
+    return -EBADMSG;
+
+  uint8_t *dst = out;
+  for (size_t i = 0; i < size; i++)
+    dst[i] = w->data[w->pos + (w->swap ? size - 1 - i : i)];
+
+  w->pos += size;
+  return 0;
+}
+
+// Read a string or signature in place, checking for NUL termination
+static int wire_read_string(Wire *w, char type, const char **out) {
+  uint32_t len;
+  if (type == SD_BUS_TYPE_SIGNATURE) {
+    uint8_t n;
+    TRY(wire_read(w, &n, 1));
+    len = n;
+  } else {
+    TRY(wire_read(w, &len, sizeof(len)));
+  }
+
+  if (w->len - w->pos <= len || w->data[w->pos + len] != '\0')
+    return -EBADMSG;
+
+  *out = (const char *) w->data + w->pos;
+  w->pos += len + 1;
+
+  return 0;
+}
+
+// Length of the complete type at the start of `sig`, or 0 if invalid
+static size_t complete_type_length(const char *sig) {
+  if (*sig == SD_BUS_TYPE_ARRAY) {
+    size_t n = complete_type_length(sig + 1);
+    return n ? n + 1 : 0;
+  }
+
+  if (*sig != '(' && *sig != '{')
+    return (is_basic_type(*sig) || *sig == 'v') ? 1 : 0;
+
+  int depth = 0;
+  for (size_t i = 0; sig[i]; i++) {
+    if (sig[i] == '(' || sig[i] == '{')
+      depth++;
+    else if ((sig[i] == ')' || sig[i] == '}') && --depth == 0)
+      return i + 1;
+  }
+
+  return 0;
+}
+
+static int unmarshal_types(Wire *, sd_bus_message *, const char *, int);
+
+static int unmarshal_basic(Wire *w, sd_bus_message *msg, char type) {
+  if (type == SD_BUS_TYPE_STRING || type == SD_BUS_TYPE_OBJECT_PATH ||
+      type == SD_BUS_TYPE_SIGNATURE) {
+    const char *str;
+    TRY(wire_read_string(w, type, &str));
+    return sd_bus_message_append_basic(msg, type, str);
+  }
+
+  size_t size = fixed_type_size(type);
+  if (!size)
+    return -EBADMSG;
+
+  uint64_t value = 0;
+  TRY(wire_read(w, &value, size));
+
+  return sd_bus_message_append_basic(msg, type, &value);
+}
+
+static int unmarshal_array(Wire *w, sd_bus_message *msg, const char *elem,
+                           int depth) {
+  uint32_t size;
+  TRY(wire_read(w, &size, sizeof(size)));
+  TRY(wire_align(w, type_alignment(elem[0])));
+
+  if (w->len - w->pos < size)
+    return -EBADMSG;
+
+  size_t end = w->pos + size;
+  TRY(sd_bus_message_open_container(msg, SD_BUS_TYPE_ARRAY, elem));
+
+  // Dictionary entries are opened with the signature inside the braces
+  char entry[256] = { 0 };
+  if (elem[0] == '{')
+    memcpy(entry, elem + 1, strlen(elem) - 2);
+
+  while (w->pos < end) {
+    if (elem[0] == '{') {
+      TRY(wire_align(w, 8));
+      TRY(sd_bus_message_open_container(msg, SD_BUS_TYPE_DICT_ENTRY, entry));
+      TRY(unmarshal_types(w, msg, entry, depth));
+      TRY(sd_bus_message_close_container(msg));
+    } else {
+      TRY(unmarshal_types(w, msg, elem, depth));
+    }
+  }
+
+  if (w->pos != end)
+    return -EBADMSG;
+
+  return sd_bus_message_close_container(msg);
+}
+
+// Append the values for each complete type in `sig` read from `w`
+static int unmarshal_types(Wire *w, sd_bus_message *msg, const char *sig,
+                           int depth) {
+  if (depth > WIRE_MAX_DEPTH)
+    return -EBADMSG;
+
+  while (*sig) {
+    size_t len = complete_type_length(sig);
+    if (len == 0 || len > SIGNATURE_MAX_LEN)
+      return -EBADMSG;
+
+    // Container contents, NUL terminated for sd-bus
+    char contents[SIGNATURE_MAX_LEN + 1];
+    memcpy(contents, sig + 1, len - 1);
+    contents[len - 1] = '\0';
+
+    switch (*sig) {
+      case SD_BUS_TYPE_UNIX_FD:
+        return -EBADMSG;
+      case SD_BUS_TYPE_VARIANT: {
+        const char *inner;
+        TRY(wire_read_string(w, SD_BUS_TYPE_SIGNATURE, &inner));
+        if (complete_type_length(inner) != strlen(inner))
+          return -EBADMSG;
+
+        TRY(sd_bus_message_open_container(msg, SD_BUS_TYPE_VARIANT, inner));
+        TRY(unmarshal_types(w, msg, inner, depth + 1));
+        TRY(sd_bus_message_close_container(msg));
+        break;
+      }
+      case SD_BUS_TYPE_ARRAY:
+        TRY(unmarshal_array(w, msg, contents, depth + 1));
+        break;
+      case SD_BUS_TYPE_STRUCT_BEGIN:
+        contents[len - 2] = '\0';
+
+        TRY(wire_align(w, 8));
+        TRY(sd_bus_message_open_container(msg, SD_BUS_TYPE_STRUCT, contents));
+        TRY(unmarshal_types(w, msg, contents, depth + 1));
+        TRY(sd_bus_message_close_container(msg));
+        break;
+      default:
+        TRY(unmarshal_basic(w, msg, *sig));
+    }
+
+    sig += len;
+  }
+
+  return 0;
+}
+
+// Header fields used to recreate a message
+typedef struct {
+  uint8_t type;
+  uint8_t flags;
+  uint32_t body_len;
+  uint32_t nfds;
+  const char *fields[FIELD_UNIX_FDS + 1];
+} WireHeader;
+
+static int read_header(Wire *w, WireHeader *hdr) {
+  if (w->len < 16 || (w->data[0] != 'l' && w->data[0] != 'B') ||
+      w->data[3] != 1)
+    return -EBADMSG;
+
+  const uint16_t probe = 1;
+  bool little          = *(const uint8_t *) &probe;
+  w->swap              = (w->data[0] == 'l') != little;
+
+  hdr->type  = w->data[1];
+  hdr->flags = w->data[2];
+  w->pos     = 4;
+
+  uint32_t serial, fields_len;
+  TRY(wire_read(w, &hdr->body_len, sizeof(uint32_t)));
+  TRY(wire_read(w, &serial, sizeof(serial)));
+  TRY(wire_read(w, &fields_len, sizeof(fields_len)));
+
+  if (w->len - w->pos < fields_len)
+    return -EBADMSG;
+
+  size_t end = w->pos + fields_len;
+  while (w->pos < end) {
+    uint8_t code;
+    const char *sig;
+    TRY(wire_align(w, 8));
+    TRY(wire_read(w, &code, 1));
+    TRY(wire_read_string(w, SD_BUS_TYPE_SIGNATURE, &sig));
+
+    if (strlen(sig) != 1)
+      return -EBADMSG;
+
+    const char *str = NULL;
+    uint32_t value  = 0;
+    if (sig[0] == SD_BUS_TYPE_UINT32)
+      TRY(wire_read(w, &value, sizeof(value)));
+    else if (strchr("sog", sig[0]))
+      TRY(wire_read_string(w, sig[0], &str));
+    else
+      return -EBADMSG;
+
+    if (code == FIELD_UNIX_FDS)
+      hdr->nfds = value;
+    else if (code <= FIELD_SIGNATURE && str)
+      hdr->fields[code] = str;
+  }
+
+  if (w->pos != end)
+    return -EBADMSG;
+
+  TRY(wire_align(w, 8));
+  if (w->len - w->pos < hdr->body_len)
+    return -EBADMSG;
+
+  w->len = w->pos + hdr->body_len;
+  return 0;
+}
+
+static void push_pcap_header(JanetBuffer *buffer) {
+  uint32_t magic      = PCAP_MAGIC;
+  uint16_t version[2] = { 2, 4 };
+  uint32_t rest[4]    = { 0, 0, PCAP_SNAPLEN, DLT_DBUS };
+
+  janet_buffer_push_bytes(buffer, (const uint8_t *) &magic, sizeof(magic));
+  janet_buffer_push_bytes(buffer, (const uint8_t *) version, sizeof(version));
+  janet_buffer_push_bytes(buffer, (const uint8_t *) rest, sizeof(rest));
+}
+
+// Stop capturing new messages. Buffered data is kept until taken.
+void capture_stop(Capture *capture) {
+  capture->filter = sd_bus_slot_unref(capture->filter);
+}
+
+void capture_free(Conn *conn) {
+  Capture *capture = conn->capture;
+  if (!capture)
+    return;
+
+  capture_stop(capture);
+
+  for (Capture **p = &g_captures; *p; p = &(*p)->next) {
+    if (*p == capture) {
+      *p = capture->next;
+      break;
+    }
+  }
+
+  janet_free(capture);
+  conn->capture = NULL;
+}
+
+JANET_FN(cfun_capture_start, "(sdbus/capture-start bus &opt limit)",
+         "Start capturing all messages received on `bus`, and all "
+         "messages sent with `sdbus/message-send` and `sdbus/call-async`, "
+         "in pcap format with the D-Bus link type.\n\n"
+         "Captured data is buffered in memory and retrieved with "
+         "`sdbus/capture-take`. Messages that would grow the buffer "
+         "beyond `limit` bytes, by default 64 MiB, are dropped and "
+         "counted in `sdbus/capture-stats`.") {
+  janet_arity(argc, 1, 2);
+
+  Conn *conn   = janet_getabstract(argv, 0, &dbus_bus_type);
+  size_t limit = janet_optsize(argv, argc, 1, CAPTURE_DEFAULT_LIMIT);
+
+  if (conn->capture && conn->capture->filter)
+    janet_panic("capture already started");
+
+  // Discard anything left over from a previous capture
+  capture_free(conn);
+
+  Capture *capture;
+  if (!(capture = janet_malloc(sizeof(Capture))))
+    JANET_OUT_OF_MEMORY;
+
+  *capture = (Capture) { .conn   = conn,
+                         .buffer = janet_buffer(4096),
+                         .limit  = limit,
+                         .next   = g_captures };
+
+  int rv = sd_bus_add_filter(conn->bus, &capture->filter, capture_filter,
+                             capture);
+  if (rv < 0) {
+    janet_free(capture);
+    janet_panicf("failed to call sd_bus_add_filter: %s", strerror(-rv));
+  }
+
+  push_pcap_header(capture->buffer);
+
+  g_captures    = capture;
+  conn->capture = capture;
+
+  return janet_wrap_nil();
+}
+
+JANET_FN(cfun_capture_take, "(sdbus/capture-take bus)",
+         "Take the capture data buffered since the last call. Returns a "
+         "buffer, which may be empty, or nil once a capture has been "
+         "stopped and all data taken.") {
+  janet_fixarity(argc, 1);
+
+  Conn *conn       = janet_getabstract(argv, 0, &dbus_bus_type);
+  Capture *capture = conn->capture;
+  if (!capture)
+    return janet_wrap_nil();
+
+  JanetBuffer *buffer = capture->buffer;
+  if (capture->filter)
+    capture->buffer = janet_buffer(buffer->count > 0 ? buffer->count : 4096);
+  else
+    capture_free(conn);
+
+  return janet_wrap_buffer(buffer);
+}
+
+JANET_FN(cfun_capture_stop, "(sdbus/capture-stop bus)",
+         "Stop capturing messages on `bus`. Data captured so far remains "
+         "available to `sdbus/capture-take`.") {
+  janet_fixarity(argc, 1);
+
+  Conn *conn = janet_getabstract(argv, 0, &dbus_bus_type);
+  if (conn->capture)
+    capture_stop(conn->capture);
+
+  return janet_wrap_nil();
+}
+
+JANET_FN(cfun_capture_stats, "(sdbus/capture-stats bus)",
+         "Return a struct with the number of `:captured` and `:dropped` "
+         "messages, and `:pending` bytes not yet taken, or nil if no "
+         "capture is active.") {
+  janet_fixarity(argc, 1);
+
+  Conn *conn       = janet_getabstract(argv, 0, &dbus_bus_type);
+  Capture *capture = conn->capture;
+  if (!capture)
+    return janet_wrap_nil();
+
+  JanetKV *st = janet_struct_begin(3);
+  janet_struct_put(st, janet_ckeywordv("captured"),
+                   janet_wrap_number((double) capture->captured));
+  janet_struct_put(st, janet_ckeywordv("dropped"),
+                   janet_wrap_number((double) capture->dropped));
+  janet_struct_put(st, janet_ckeywordv("pending"),
+                   janet_wrap_integer(capture->buffer->count));
+
+  return janet_wrap_struct(janet_struct_end(st));
+}
+
+JANET_FN(cfun_message_from_wire, "(sdbus/message-from-wire bus bytes)",
+         "Recreate a method call or signal from a message in D-Bus wire "
+         "format, as found in the records of a capture. The new message "
+         "is unsent and may be passed to `sdbus/message-send`. Returns "
+         "nil for method returns, errors, and messages carrying file "
+         "descriptors, which cannot be replayed.") {
+  janet_fixarity(argc, 2);
+
+  Conn *conn          = janet_getabstract(argv, 0, &dbus_bus_type);
+  JanetByteView bytes = janet_getbytes(argv, 1);
+
+  Wire w         = { .data = bytes.bytes, .len = (size_t) bytes.len };
+  WireHeader hdr = { 0 };
+  if (read_header(&w, &hdr) < 0)
+    janet_panic("malformed D-Bus message");
+
+  const char **fields = hdr.fields;
+  if (hdr.nfds > 0 || !fields[FIELD_PATH] || !fields[FIELD_MEMBER])
+    return janet_wrap_nil();
+
+  if (hdr.type != SD_BUS_MESSAGE_METHOD_CALL &&
+      hdr.type != SD_BUS_MESSAGE_SIGNAL)
+    return janet_wrap_nil();
+
+  sd_bus_message **msg_ptr =
+      janet_abstract(&dbus_message_type, sizeof(sd_bus_message *));
+  *msg_ptr = NULL;
+
+  if (hdr.type == SD_BUS_MESSAGE_METHOD_CALL) {
+    CALL_SD_BUS_FUNC(sd_bus_message_new_method_call, conn->bus, msg_ptr,
+                     fields[FIELD_DESTINATION], fields[FIELD_PATH],
+                     fields[FIELD_INTERFACE], fields[FIELD_MEMBER]);
+    CALL_SD_BUS_FUNC(sd_bus_message_set_expect_reply, *msg_ptr,
+                     !(hdr.flags & FLAG_NO_REPLY_EXPECTED));
+  } else {
+    CALL_SD_BUS_FUNC(sd_bus_message_new_signal, conn->bus, msg_ptr,
+                     fields[FIELD_PATH], fields[FIELD_INTERFACE],
+                     fields[FIELD_MEMBER]);
+  }
+
+  CALL_SD_BUS_FUNC(sd_bus_message_set_auto_start, *msg_ptr,
+                   !(hdr.flags & FLAG_NO_AUTO_START));
+  CALL_SD_BUS_FUNC(sd_bus_message_set_allow_interactive_authorization,
+                   *msg_ptr, !!(hdr.flags & FLAG_ALLOW_INTERACTIVE));
+
+  const char *signature = fields[FIELD_SIGNATURE];
+
+  int rv = unmarshal_types(&w, *msg_ptr, signature ? signature : "", 0);
+  if (rv == 0 && w.pos != w.len)
+    rv = -EBADMSG;
+
+  if (rv < 0)
+    janet_panicf("failed to decode message body: %s", strerror(-rv));
+
+  return janet_wrap_abstract(msg_ptr);
+}
+
+JanetRegExt cfuns_capture[] = {
+  JANET_REG("capture-start", cfun_capture_start),
+  JANET_REG("capture-take", cfun_capture_take),
+  JANET_REG("capture-stop", cfun_capture_stop),
+  JANET_REG("capture-stats", cfun_capture_stats),
+  JANET_REG("message-from-wire", cfun_message_from_wire), JANET_REG_END
+};
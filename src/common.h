@@ -56,11 +56,35 @@ typedef struct {
   JanetStream *bus_stream;    // Unix fd for bus connection
   JanetStream *timer;         // Timer fd for bus timeouts
   struct AsyncPending *queue; // Queue of pending async calls
+  int32_t ncalls;             // Method calls in the queue
+  struct Batch *batches;      // Messages held for batched delivery
+  struct MatchFilter *held;   // Filters with held messages or limits
+  struct Capture *capture;    // Traffic capture, NULL if none
+  uint64_t deadline;          // Armed timer deadline, UINT64_MAX if none
+  uint32_t events;            // Events registered for the bus stream
+  uint64_t syscalls;          // Timer and poll updates made
+  uint64_t skipped;           // Timer and poll updates found redundant
+  uint32_t budget;            // Messages dispatched per wakeup, 0 if unbounded
+  uint64_t slice;             // Time per wakeup in usec, 0 if unbounded
+  uint64_t budget_hits;       // Wakeups which ran out of budget
+  uint64_t max_pass;          // Longest dispatch pass in usec
+  struct CallState *spare;    // Freed call states kept for reuse
+  uint32_t nspare;            // Number of spare call states
+  bool dispatching;           // Inside sd_bus_process
 } Conn;
 
 extern const JanetAbstractType dbus_bus_type;
 extern JanetRegExt cfuns_bus[];
 
+extern void close_conn(Conn *);
+
+// Pool of D-Bus connections
+extern const JanetAbstractType dbus_pool_type;
+extern JanetRegExt cfuns_pool[];
+
+extern Conn *getconn(const Janet *, int32_t);
+extern Conn *pool_conn_for(const Janet *, int32_t, sd_bus_message *);
+
 // Pending async call
 typedef struct AsyncPending {
   sd_bus_slot **slot;
@@ -70,27 +94,184 @@ typedef struct AsyncPending {
     Call,
     Match
   } kind;
+  bool batch;                 // Deliver messages in batches
+  JanetFunction *callback;    // Called with each message instead of chan
+  JanetFiber *fiber;          // Fiber reused for calls to callback
+  struct MatchFilter *filter; // Client-side filter, NULL if none
+  uint64_t cookie;            // BecomeMonitor call awaiting a reply, or 0
+  int32_t calls;              // Method calls counted in Conn.ncalls
+  sd_bus_slot *bus_slot;      // Floating slot, disconnected on close
+  struct CallGroup *group;    // Calls sent together, NULL if none
 } AsyncPending;
 
+typedef struct {
+  Conn *conn;
+  AsyncPending *pending;
+} AsyncState;
+
+// Messages for a channel dispatched in the current processing pass
+typedef struct Batch {
+  JanetChannel *chan;
+  JanetArray *msgs;
+  struct Batch *next;
+} Batch;
+
+extern void init_async_pending(AsyncPending *, JanetChannel *, bool);
 extern AsyncPending *create_async_pending(JanetChannel *);
-extern void queue_pending(AsyncPending **, AsyncPending *);
-extern void dequeue_pending(AsyncPending **, AsyncPending *);
+extern void queue_pending(Conn *, AsyncPending *);
+extern void dequeue_pending(Conn *, AsyncPending *);
+extern void settle_calls(Conn *, AsyncPending *, int32_t);
+extern void group_disconnect(struct CallGroup *);
+extern void batch_push(Conn *, JanetChannel *, Janet);
+extern void flush_batches(Conn *, JanetChannel *);
 extern void init_async(Conn *);
 extern void settimeout(Conn *);
 extern void setevents(Conn *);
+extern void require_event_loop(Conn *);
+extern uint64_t now_usec(void);
 
 // D-Bus call
 extern JanetRegExt cfuns_call[];
 
+extern void deliver(Conn *, AsyncPending *, sd_bus_message *);
+extern void free_call_states(Conn *);
+
+// Client-side match filtering, coalescing, and queue limits
+typedef struct MatchFilter MatchFilter;
+
+extern JanetRegExt cfuns_filter[];
+
+extern MatchFilter *filter_new(Conn *, Janet, const char *);
+extern void filter_attach(MatchFilter *, AsyncPending *);
+extern void filter_free(MatchFilter *);
+extern bool filter_accept(MatchFilter *, sd_bus_message *);
+extern void filter_flush(Conn *, uint64_t);
+extern uint64_t filter_deadline(Conn *);
+
 // D-Bus message
 extern const JanetAbstractType dbus_message_type;
 extern JanetRegExt cfuns_message[];
 
+// Flags controlling how message contents are read into Janet
+enum {
+  DECODE_PACKED   = 1 << 0, // Fixed-width arrays as native-endian buffers
+  DECODE_KEYWORDS = 1 << 1, // String dictionary keys as keywords
+  DECODE_FROZEN   = 1 << 2, // Tuples, structs, and strings
+  DECODE_BLOBS    = 1 << 3  // Sealed memfds as mapped blobs
+};
+
+// State struct when reading message contents
+typedef struct {
+  sd_bus_message *msg;
+  uint64_t flags;
+  Janet *stack;     // Scratch space for container elements
+  int32_t top;      // Number of values on the stack
+  int32_t capacity; // Allocated size of the stack
+} Decoder;
+
+#define DECODE_FLAGS "pkfb"
+
+extern JANET_THREAD_LOCAL uint64_t g_decode_allocs;
+
+extern int read_complete_type(Decoder *, Janet *);
+extern Janet read_basic_type(Decoder *, char);
+extern Janet read_dict_key(Decoder *, char);
+extern void decoder_deinit(Decoder *);
+extern Janet read_items(sd_bus_message *, uint64_t, bool, int32_t);
+extern size_t fixed_type_size(int);
+
+// String interning
+extern JanetRegExt cfuns_intern[];
+
+extern Janet intern_string(const char *);
+
+// JSON encoding
+extern JanetRegExt cfuns_json[];
+
+// Sealed memfd blobs
+extern JanetRegExt cfuns_blob[];
+
+extern int blob_from_fd(int, Janet *);
+
+// Bus traffic capture in pcap format
+typedef struct Capture {
+  Conn *conn;
+  JanetBuffer *buffer;  // Captured records not yet taken
+  sd_bus_slot *filter;  // Filter slot, NULL once stopped
+  size_t limit;         // Maximum size of buffered records
+  uint64_t captured;    // Number of messages captured
+  uint64_t dropped;     // Number of messages dropped
+  struct Capture *next; // Next capture on this thread
+} Capture;
+
+extern JanetRegExt cfuns_capture[];
+
+extern void capture_message(sd_bus_message *);
+extern void capture_stop(Capture *);
+extern void capture_free(Conn *);
+
+// D-Bus message view
+extern const JanetAbstractType dbus_view_type;
+extern JanetRegExt cfuns_view[];
+
+extern void view_cursor_release(sd_bus_message *);
+extern void view_cursor_reset(sd_bus_message *);
+
+// Streaming message iterator
+extern JanetRegExt cfuns_iterator[];
+
+extern void iterator_invalidate(sd_bus_message *);
+
 // D-Bus export
 extern JanetRegExt cfuns_export[];
 
 // D-Bus slot
 extern const JanetAbstractType dbus_slot_type;
+
+// Contents of a bus slot object. Matches keep their filter here, so
+// that its counters are never read through the userdata of a slot
+// which may belong to an export or to a finished call.
+typedef struct {
+  sd_bus_slot *slot;          // First, so the object is a sd_bus_slot **
+  struct MatchFilter *filter; // Filter of a live match, NULL otherwise
+} BusSlot;
 extern JanetRegExt cfuns_slot[];
 
+// D-Bus signature compiled into a flat, pre-order list of complete
+// types with container boundaries resolved
+typedef struct {
+  char type;            // D-Bus type code, '{' for dictionary arrays
+  uint32_t next;        // Index of the following sibling type
+  uint32_t nfields;     // Number of member types in a struct
+  const char *contents; // Contents signature when a container
+  const char *entry;    // Dictionary entry signature without braces
+  const char *sig;      // Start of this type in the full signature
+  size_t len;           // Length of this type in the full signature
+} SignatureNode;
+
+typedef struct {
+  const char *signature; // Full signature string
+  uint32_t count;        // Number of nodes
+  uint32_t nargs;        // Number of top-level complete types
+  SignatureNode nodes[];
+} Signature;
+
+extern const JanetAbstractType dbus_signature_type;
+extern JanetRegExt cfuns_signature[];
+
+extern bool is_basic_type(int);
+extern uint32_t signature_count(const char *);
+extern const Signature *signature_lookup(JanetString);
+extern const Signature *getsignature(const Janet *, int32_t);
+extern void append_data(sd_bus_message *, const Signature *, Janet *, int32_t);
+
+// D-Bus message template
+extern const JanetAbstractType dbus_template_type;
+extern JanetRegExt cfuns_template[];
+
+extern sd_bus_message **template_instantiate(const Janet *, int32_t,
+                                             const Janet *, int32_t);
+extern sd_bus_message **get_message(const Janet *, int32_t, const Janet *,
+                                    int32_t);
+
 #endif
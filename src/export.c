@@ -319,9 +319,9 @@ JANET_FN(cfun_export, "(sdbus/export bus path interface env)",
   sd_bus_vtable *vtable = create_vtable(env.len + 2, env);
   ExportState *state    = init_export_state(conn, vtable, argv[3]);
 
-  sd_bus_slot **slot_ptr =
-      janet_abstract(&dbus_slot_type, sizeof(sd_bus_slot *));
-  *slot_ptr = NULL;
+  BusSlot *slot_obj      = janet_abstract(&dbus_slot_type, sizeof(BusSlot));
+  *slot_obj              = (BusSlot) { 0 };
+  sd_bus_slot **slot_ptr = &slot_obj->slot;
 
   int rv = sd_bus_add_object_vtable(conn->bus, slot_ptr, path, interface,
                                     vtable, state);
@@ -0,0 +1,749 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Joshua Krusell
+
+#include <fnmatch.h>
+
+#include "common.h"
+
+#define FILTER_MAX_ARG    63
+#define FILTER_MAX_WINDOW 3600
+
+// Interval in usec for checking whether a full channel has drained.
+// Janet channels have no hook for takes, so a paused match or held
+// messages keep the connection timer firing at this rate.
+#define FILTER_RETRY 10000
+
+enum {
+  KeyPath,
+  KeyInterface,
+  KeyMember
+};
+
+// Policies when the channel of a match holds its queue limit
+enum {
+  DropOldest,
+  DropNewest,
+  CoalesceFull,
+  Pause
+};
+
+// Condition on a basic argument of a message
+typedef struct {
+  int32_t index;
+  bool prefix; // Match a string prefix rather than equality
+  bool numeric;
+  double number;
+  char *string;
+  size_t len;
+} ArgFilter;
+
+// Latest message held for a coalescing key
+typedef struct HeldMessage {
+  uint64_t hash;
+  char *key;
+  sd_bus_message *msg;
+  uint64_t deadline;
+  struct HeldMessage *chain; // Next in hash bucket
+  struct HeldMessage *next;  // Next to expire
+} HeldMessage;
+
+struct MatchFilter {
+  Conn *conn;
+  AsyncPending *pending;
+  ArgFilter *args; // Sorted by argument index
+  int32_t nargs;
+  char *path;      // Object path glob, NULL if none
+  uint32_t sample; // Deliver one in `sample` messages
+  uint64_t window; // Coalescing window in usec, 0 if disabled
+  int key;         // Header fields forming the coalescing key
+  int32_t limit;   // Channel items before overflow, 0 if unbounded
+  int overflow;    // Overflow policy
+  char *rule;      // Match rule, kept for pausing
+  bool paused;     // Match removed from the bus until the channel drains
+
+  HeldMessage **buckets;
+  uint32_t nbuckets, nheld;
+  HeldMessage *oldest, *newest;
+  char *keybuf; // Scratch space for building keys
+  size_t keycap;
+
+  uint64_t passed; // Messages accepted by the conditions
+  uint64_t received, filtered, coalesced, delivered, dropped;
+  struct MatchFilter *next; // Next filter on the connection needing timers
+};
+
+static char *copy_string(const char *str, size_t len) {
+  char *copy;
+  if (!(copy = janet_malloc(len + 1)))
+    JANET_OUT_OF_MEMORY;
+
+  memcpy(copy, str, len);
+  copy[len] = '\0';
+
+  return copy;
+}
+
+static int32_t count_args(Janet dict, bool prefix) {
+  if (janet_checktype(dict, JANET_NIL))
+    return 0;
+
+  const JanetKV *kvs;
+  int32_t len, cap;
+  if (!janet_dictionary_view(dict, &kvs, &len, &cap))
+    janet_panicf("expected dictionary of argument conditions, got %v", dict);
+
+  int32_t count = 0;
+  for (int32_t i = 0; i < cap; i++) {
+    const JanetKV *kv = &kvs[i];
+    if (janet_checktype(kv->key, JANET_NIL))
+      continue;
+
+    if (!janet_checkint(kv->key) || janet_unwrap_integer(kv->key) < 0 ||
+        janet_unwrap_integer(kv->key) > FILTER_MAX_ARG)
+      janet_panicf("expected argument index between 0 and %d, got %v",
+                   FILTER_MAX_ARG, kv->key);
+
+    if (!janet_checktype(kv->value, JANET_STRING) &&
+        (prefix || !janet_checktype(kv->value, JANET_NUMBER)))
+      janet_panicf("expected %s for argument %v, got %v",
+                   prefix ? "string" : "string or number", kv->key,
+                   kv->value);
+
+    count++;
+  }
+
+  return count;
+}
+
+static int32_t add_args(ArgFilter *args, Janet dict, bool prefix) {
+  if (janet_checktype(dict, JANET_NIL))
+    return 0;
+
+  const JanetKV *kvs;
+  int32_t len, cap;
+  janet_dictionary_view(dict, &kvs, &len, &cap);
+
+  int32_t n = 0;
+  for (int32_t i = 0; i < cap; i++) {
+    const JanetKV *kv = &kvs[i];
+    if (janet_checktype(kv->key, JANET_NIL))
+      continue;
+
+    ArgFilter *arg = &args[n++];
+    *arg = (ArgFilter) { .index = janet_unwrap_integer(kv->key),
+                         .prefix = prefix };
+
+    if (janet_checktype(kv->value, JANET_NUMBER)) {
+      arg->numeric = true;
+      arg->number  = janet_unwrap_number(kv->value);
+    } else {
+      JanetString str = janet_unwrap_string(kv->value);
+      arg->len        = janet_string_length(str);
+      arg->string     = copy_string((const char *) str, arg->len);
+    }
+  }
+
+  return n;
+}
+
+static int compare_args(const void *a, const void *b) {
+  return ((const ArgFilter *) a)->index - ((const ArgFilter *) b)->index;
+}
+
+static int getkey(Janet value) {
+  if (janet_checktype(value, JANET_NIL))
+    return KeyInterface;
+
+  if (janet_checktype(value, JANET_KEYWORD)) {
+    JanetKeyword kw = janet_unwrap_keyword(value);
+    if (janet_cstrcmp(kw, "path") == 0)
+      return KeyPath;
+    if (janet_cstrcmp(kw, "interface") == 0)
+      return KeyInterface;
+    if (janet_cstrcmp(kw, "member") == 0)
+      return KeyMember;
+  }
+
+  janet_panicf("expected :path, :interface, or :member, got %v", value);
+}
+
+static int getoverflow(Janet value) {
+  if (janet_checktype(value, JANET_NIL))
+    return DropOldest;
+
+  if (janet_checktype(value, JANET_KEYWORD)) {
+    JanetKeyword kw = janet_unwrap_keyword(value);
+    if (janet_cstrcmp(kw, "drop-oldest") == 0)
+      return DropOldest;
+    if (janet_cstrcmp(kw, "drop-newest") == 0)
+      return DropNewest;
+    if (janet_cstrcmp(kw, "coalesce") == 0)
+      return CoalesceFull;
+    if (janet_cstrcmp(kw, "pause") == 0)
+      return Pause;
+  }
+
+  janet_panicf("expected :drop-oldest, :drop-newest, :coalesce, or :pause, "
+               "got %v",
+               value);
+}
+
+MatchFilter *filter_new(Conn *conn, Janet opts, const char *rule) {
+  Janet args   = janet_get(opts, janet_ckeywordv("args"));
+  Janet prefix = janet_get(opts, janet_ckeywordv("arg-prefix"));
+  Janet path   = janet_get(opts, janet_ckeywordv("path"));
+  Janet sample = janet_get(opts, janet_ckeywordv("sample"));
+  Janet window = janet_get(opts, janet_ckeywordv("coalesce"));
+
+  // Validate everything before allocating so that a panic cannot leak
+  int32_t nargs = count_args(args, false) + count_args(prefix, true);
+
+  if (!janet_checktype(path, JANET_NIL) &&
+      !janet_checktype(path, JANET_STRING))
+    janet_panicf("expected object path glob, got %v", path);
+
+  if (!janet_checktype(sample, JANET_NIL) &&
+      (!janet_checkint(sample) || janet_unwrap_integer(sample) < 1))
+    janet_panicf("expected positive sampling interval, got %v", sample);
+
+  double seconds = 0;
+  if (!janet_checktype(window, JANET_NIL)) {
+    if (!janet_checktype(window, JANET_NUMBER) ||
+        !(janet_unwrap_number(window) > 0) ||
+        janet_unwrap_number(window) > FILTER_MAX_WINDOW)
+      janet_panicf("expected coalescing window between 0 and %d seconds, "
+                   "got %v",
+                   FILTER_MAX_WINDOW, window);
+
+    seconds = janet_unwrap_number(window);
+  }
+
+  int key = getkey(janet_get(opts, janet_ckeywordv("coalesce-by")));
+
+  Janet limit  = janet_get(opts, janet_ckeywordv("queue-limit"));
+  int overflow = getoverflow(janet_get(opts, janet_ckeywordv("overflow")));
+  if (!janet_checktype(limit, JANET_NIL) &&
+      (!janet_checkint(limit) || janet_unwrap_integer(limit) < 1))
+    janet_panicf("expected positive queue limit, got %v", limit);
+
+  if (overflow == Pause && !janet_checktype(limit, JANET_NIL)) {
+    if (!rule)
+      janet_panic("the :pause policy requires a match rule");
+
+    if (sd_bus_is_bus_client(conn->bus) <= 0)
+      janet_panic("pausing a match requires a message bus connection");
+  }
+
+  if (nargs == 0 && janet_checktype(path, JANET_NIL) &&
+      janet_checktype(sample, JANET_NIL) && seconds == 0 &&
+      janet_checktype(limit, JANET_NIL))
+    return NULL;
+
+  MatchFilter *filter;
+  if (!(filter = janet_calloc(1, sizeof(MatchFilter))))
+    JANET_OUT_OF_MEMORY;
+
+  filter->conn   = conn;
+  filter->sample = janet_checktype(sample, JANET_NIL)
+                       ? 1
+                       : (uint32_t) janet_unwrap_integer(sample);
+  filter->window = (uint64_t) (seconds * 1e6);
+  filter->key    = key;
+
+  if (!janet_checktype(limit, JANET_NIL)) {
+    filter->limit    = janet_unwrap_integer(limit);
+    filter->overflow = overflow;
+
+    if (overflow == Pause)
+      filter->rule = copy_string(rule, strlen(rule));
+  }
+
+  if (nargs > 0) {
+    if (!(filter->args = janet_malloc(nargs * sizeof(ArgFilter))))
+      JANET_OUT_OF_MEMORY;
+
+    filter->nargs = add_args(filter->args, args, false);
+    filter->nargs += add_args(filter->args + filter->nargs, prefix, true);
+    qsort(filter->args, filter->nargs, sizeof(ArgFilter), compare_args);
+  }
+
+  if (janet_checktype(path, JANET_STRING)) {
+    JanetString str = janet_unwrap_string(path);
+    filter->path = copy_string((const char *) str, janet_string_length(str));
+  }
+
+  if (filter->window || filter->limit) {
+    filter->next = conn->held;
+    conn->held   = filter;
+  }
+
+  return filter;
+}
+
+void filter_attach(MatchFilter *filter, AsyncPending *pending) {
+  filter->pending                     = pending;
+  ((BusSlot *) pending->slot)->filter = filter;
+}
+
+static void release_held(MatchFilter *filter) {
+  HeldMessage *held = filter->oldest;
+  while (held) {
+    HeldMessage *next = held->next;
+    sd_bus_message_unref(held->msg);
+    janet_free(held->key);
+    janet_free(held);
+    held = next;
+  }
+
+  janet_free(filter->buckets);
+  filter->buckets = NULL;
+  filter->oldest = filter->newest = NULL;
+  filter->nbuckets = filter->nheld = 0;
+}
+
+void filter_free(MatchFilter *filter) {
+  if (!filter)
+    return;
+
+  if (filter->window || filter->limit) {
+    MatchFilter **p = &filter->conn->held;
+    while (*p && *p != filter)
+      p = &(*p)->next;
+
+    if (*p)
+      *p = filter->next;
+  }
+
+  release_held(filter);
+
+  for (int32_t i = 0; i < filter->nargs; i++)
+    janet_free(filter->args[i].string);
+
+  janet_free(filter->args);
+  janet_free(filter->path);
+  janet_free(filter->rule);
+  janet_free(filter->keybuf);
+  janet_free(filter);
+}
+
+static bool read_number(sd_bus_message *msg, char type, double *out) {
+  union {
+    uint8_t u8;
+    int16_t i16;
+    uint16_t u16;
+    int32_t i32;
+    uint32_t u32;
+    int64_t i64;
+    uint64_t u64;
+    double d;
+    int b;
+  } value;
+
+  if (sd_bus_message_read_basic(msg, type, &value) < 0)
+    return false;
+
+  switch (type) {
+    case SD_BUS_TYPE_BYTE:
+      *out = value.u8;
+      return true;
+    case SD_BUS_TYPE_BOOLEAN:
+      *out = value.b;
+      return true;
+    case SD_BUS_TYPE_INT16:
+      *out = value.i16;
+      return true;
+    case SD_BUS_TYPE_UINT16:
+      *out = value.u16;
+      return true;
+    case SD_BUS_TYPE_INT32:
+      *out = value.i32;
+      return true;
+    case SD_BUS_TYPE_UINT32:
+      *out = value.u32;
+      return true;
+    case SD_BUS_TYPE_INT64:
+      *out = (double) value.i64;
+      return true;
+    case SD_BUS_TYPE_UINT64:
+      *out = (double) value.u64;
+      return true;
+    case SD_BUS_TYPE_DOUBLE:
+      *out = value.d;
+      return true;
+    default:
+      return false;
+  }
+}
+
+static bool match_arg(sd_bus_message *msg, const ArgFilter *arg) {
+  char type;
+  if (sd_bus_message_peek_type(msg, &type, NULL) <= 0)
+    return false;
+
+  if (type == SD_BUS_TYPE_STRING || type == SD_BUS_TYPE_OBJECT_PATH ||
+      type == SD_BUS_TYPE_SIGNATURE) {
+    const char *str;
+    if (arg->numeric || sd_bus_message_read_basic(msg, type, &str) < 0)
+      return false;
+
+    size_t len = strlen(str);
+    if (arg->prefix)
+      return len >= arg->len && memcmp(str, arg->string, arg->len) == 0;
+
+    return len == arg->len && memcmp(str, arg->string, len) == 0;
+  }
+
+  double number;
+  return arg->numeric && read_number(msg, type, &number) &&
+         number == arg->number;
+}
+
+// Arguments are visited in index order, skipping those in between
+static bool match_args(MatchFilter *filter, sd_bus_message *msg) {
+  // The same message may be delivered to other matches with views on it
+  view_cursor_reset(msg);
+  if (sd_bus_message_rewind(msg, true) < 0)
+    return false;
+
+  bool matched = true;
+  int32_t position = 0;
+  for (int32_t i = 0; i < filter->nargs && matched; i++) {
+    const ArgFilter *arg = &filter->args[i];
+
+    // Several conditions may apply to the same argument
+    if (arg->index < position) {
+      if (sd_bus_message_rewind(msg, true) < 0)
+        return false;
+      position = 0;
+    }
+
+    for (; position < arg->index; position++) {
+      if (sd_bus_message_skip(msg, NULL) <= 0) {
+        matched = false;
+        break;
+      }
+    }
+
+    if (matched) {
+      matched = match_arg(msg, arg);
+      position++;
+    }
+  }
+
+  sd_bus_message_rewind(msg, true);
+  return matched;
+}
+
+static uint64_t hash_key(const char *key, size_t len) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (size_t i = 0; i < len; i++)
+    hash = (hash ^ (uint8_t) key[i]) * 0x100000001b3;
+
+  return hash;
+}
+
+// Concatenate the header fields forming the key of a message
+static size_t build_key(MatchFilter *filter, sd_bus_message *msg) {
+  const char *fields[3] = { sd_bus_message_get_path(msg),
+                            sd_bus_message_get_interface(msg),
+                            sd_bus_message_get_member(msg) };
+
+  size_t len = 0;
+  for (int i = 0; i <= filter->key; i++)
+    len += (fields[i] ? strlen(fields[i]) : 0) + 1;
+
+  if (len > filter->keycap) {
+    char *buf = janet_realloc(filter->keybuf, len);
+    if (!buf)
+      JANET_OUT_OF_MEMORY;
+
+    filter->keybuf = buf;
+    filter->keycap = len;
+  }
+
+  size_t n = 0;
+  for (int i = 0; i <= filter->key; i++) {
+    size_t flen = fields[i] ? strlen(fields[i]) : 0;
+    memcpy(filter->keybuf + n, fields[i] ? fields[i] : "", flen);
+    n += flen;
+    filter->keybuf[n++] = '\0';
+  }
+
+  return n;
+}
+
+static void grow_buckets(MatchFilter *filter) {
+  uint32_t nbuckets = filter->nbuckets ? filter->nbuckets * 2 : 16;
+
+  HeldMessage **buckets;
+  if (!(buckets = janet_calloc(nbuckets, sizeof(HeldMessage *))))
+    JANET_OUT_OF_MEMORY;
+
+  for (HeldMessage *held = filter->oldest; held; held = held->next) {
+    HeldMessage **bucket = &buckets[held->hash & (nbuckets - 1)];
+    held->chain          = *bucket;
+    *bucket              = held;
+  }
+
+  janet_free(filter->buckets);
+  filter->buckets  = buckets;
+  filter->nbuckets = nbuckets;
+}
+
+// Hold `msg` until the coalescing window for its key closes, or until
+// the channel has room when coalescing on overflow, replacing any
+// message already held for the same key
+static void hold(MatchFilter *filter, sd_bus_message *msg) {
+  size_t len    = build_key(filter, msg);
+  uint64_t hash = hash_key(filter->keybuf, len);
+
+  if (filter->nbuckets) {
+    HeldMessage *held = filter->buckets[hash & (filter->nbuckets - 1)];
+    for (; held; held = held->chain) {
+      if (held->hash == hash && memcmp(held->key, filter->keybuf, len) == 0) {
+        sd_bus_message_unref(held->msg);
+        held->msg = sd_bus_message_ref(msg);
+        filter->coalesced++;
+        return;
+      }
+    }
+  }
+
+  if (filter->nheld >= filter->nbuckets)
+    grow_buckets(filter);
+
+  HeldMessage *held;
+  if (!(held = janet_malloc(sizeof(HeldMessage))))
+    JANET_OUT_OF_MEMORY;
+
+  HeldMessage **bucket = &filter->buckets[hash & (filter->nbuckets - 1)];
+  *held = (HeldMessage) { .hash     = hash,
+                          .key      = copy_string(filter->keybuf, len),
+                          .msg      = sd_bus_message_ref(msg),
+                          .deadline = now_usec() + filter->window,
+                          .chain    = *bucket };
+  *bucket = held;
+
+  // The window is the same for every key, so expiry is in FIFO order
+  if (filter->newest)
+    filter->newest->next = held;
+  else
+    filter->oldest = held;
+
+  filter->newest = held;
+  filter->nheld++;
+}
+
+// Number of items in a channel, as returned by `ev/count`
+static int32_t channel_count(JanetChannel *chan) {
+  static JANET_THREAD_LOCAL JanetCFunction count = NULL;
+  if (!count)
+    count = janet_unwrap_cfunction(janet_resolve_core("ev/count"));
+
+  Janet arg = janet_wrap_abstract(chan);
+  return janet_unwrap_integer(count(1, &arg));
+}
+
+static bool has_room(MatchFilter *filter) {
+  return !filter->limit ||
+         channel_count(filter->pending->chan) < filter->limit;
+}
+
+// Remove the match rule from the bus, or add it back, so that the
+// broker stops routing messages while the channel is full. The local
+// slot is untouched, and a failed request only means that messages
+// keep arriving and are dropped.
+static void set_paused(MatchFilter *filter, bool paused) {
+  int rv = sd_bus_call_method_async(
+      filter->conn->bus, NULL, "org.freedesktop.DBus",
+      "/org/freedesktop/DBus", "org.freedesktop.DBus",
+      paused ? "RemoveMatch" : "AddMatch", NULL, NULL, "s", filter->rule);
+
+  if (rv >= 0)
+    filter->paused = paused;
+}
+
+// Make room in the channel for one more item according to the
+// overflow policy. Returns false if the message must not be delivered
+// now.
+static bool make_room(MatchFilter *filter) {
+  if (has_room(filter))
+    return true;
+
+  switch (filter->overflow) {
+    case DropOldest: {
+      Janet item;
+      janet_channel_take(filter->pending->chan, &item);
+      filter->dropped++;
+      return true;
+    }
+
+    case Pause:
+      if (!filter->paused)
+        set_paused(filter, true);
+      return false;
+
+    default:
+      return false;
+  }
+}
+
+bool filter_accept(MatchFilter *filter, sd_bus_message *msg) {
+  filter->received++;
+
+  if (filter->path) {
+    const char *path = sd_bus_message_get_path(msg);
+    if (!path || fnmatch(filter->path, path, FNM_PATHNAME) != 0)
+      goto reject;
+  }
+
+  if (filter->nargs && !match_args(filter, msg))
+    goto reject;
+
+  if (filter->passed++ % filter->sample != 0)
+    goto reject;
+
+  bool signal = sd_bus_message_is_signal(msg, NULL, NULL) > 0;
+  if (filter->window && signal) {
+    hold(filter, msg);
+    return false;
+  }
+
+  if (!make_room(filter)) {
+    if (filter->overflow == CoalesceFull && signal)
+      hold(filter, msg);
+    else
+      filter->dropped++;
+
+    return false;
+  }
+
+  filter->delivered++;
+  return true;
+
+reject:
+  filter->filtered++;
+  return false;
+}
+
+// Filters with a held message ready to be delivered
+static MatchFilter *find_ready(Conn *conn, uint64_t now) {
+  for (MatchFilter *filter = conn->held; filter; filter = filter->next) {
+    if (!filter->oldest || filter->oldest->deadline > now)
+      continue;
+
+    if (filter->overflow == CoalesceFull && !has_room(filter))
+      continue;
+
+    return filter;
+  }
+
+  return NULL;
+}
+
+// Resume paused matches once their channel is half empty, then deliver
+// held messages whose window has closed. A callback may cancel any
+// match on the connection, so the list is searched again after each
+// delivery.
+void filter_flush(Conn *conn, uint64_t now) {
+  MatchFilter *filter;
+  for (filter = conn->held; filter; filter = filter->next) {
+    if (filter->paused &&
+        channel_count(filter->pending->chan) <= filter->limit / 2)
+      set_paused(filter, false);
+  }
+
+  while ((filter = find_ready(conn, now))) {
+    HeldMessage *held = filter->oldest;
+
+    filter->oldest = held->next;
+    if (!filter->oldest)
+      filter->newest = NULL;
+
+    HeldMessage **p = &filter->buckets[held->hash & (filter->nbuckets - 1)];
+    while (*p != held)
+      p = &(*p)->chain;
+    *p = held->chain;
+
+    filter->nheld--;
+
+    sd_bus_message *msg = held->msg;
+    janet_free(held->key);
+    janet_free(held);
+
+    if (!make_room(filter)) {
+      filter->dropped++;
+      sd_bus_message_unref(msg);
+      continue;
+    }
+
+    filter->delivered++;
+
+    // Outside of sd_bus_process, nothing else keeps the slot alive if a
+    // callback cancels its own match
+    sd_bus_slot *slot = sd_bus_slot_ref(filter->pending->bus_slot);
+    deliver(conn, filter->pending, msg);
+    sd_bus_slot_unref(slot);
+  }
+}
+
+// Held messages waiting for room and paused matches are checked again
+// after a short interval
+uint64_t filter_deadline(Conn *conn) {
+  uint64_t now      = now_usec();
+  uint64_t deadline = UINT64_MAX;
+  for (MatchFilter *filter = conn->held; filter; filter = filter->next) {
+    uint64_t next = UINT64_MAX;
+    if (filter->paused)
+      next = now + FILTER_RETRY;
+    else if (filter->oldest && filter->oldest->deadline > now)
+      next = filter->oldest->deadline;
+    else if (filter->oldest)
+      next = has_room(filter) ? now : now + FILTER_RETRY;
+
+    if (next < deadline)
+      deadline = next;
+  }
+
+  return deadline;
+}
+
+JANET_FN(cfun_match_stats, "(sdbus/match-stats slot)",
+         "Return a struct with counters for a match created by "
+         "`sdbus/match-async` with filtering options, or nil if the "
+         "match has none. `:received` is the number of messages matched "
+         "by the bus, `:filtered` those rejected by the filters or "
+         "sampling, `:coalesced` those replaced by a later message with "
+         "the same key, `:dropped` those discarded by the overflow "
+         "policy of a queue limit, and `:delivered` those written to the "
+         "channel or passed to the callback. `:paused` is true while the "
+         "match is removed from the bus by the `:pause` policy.\n\n"
+         "The same struct is returned by the `:stats` method of the "
+         "slot.") {
+  janet_fixarity(argc, 1);
+
+  BusSlot *slot_obj   = janet_getabstract(argv, 0, &dbus_slot_type);
+  MatchFilter *filter = slot_obj->filter;
+  if (!slot_obj->slot || !filter)
+    return janet_wrap_nil();
+
+  JanetKV *st = janet_struct_begin(6);
+  janet_struct_put(st, janet_ckeywordv("received"),
+                   janet_wrap_number((double) filter->received));
+  janet_struct_put(st, janet_ckeywordv("filtered"),
+                   janet_wrap_number((double) filter->filtered));
+  janet_struct_put(st, janet_ckeywordv("coalesced"),
+                   janet_wrap_number((double) filter->coalesced));
+  janet_struct_put(st, janet_ckeywordv("delivered"),
+                   janet_wrap_number((double) filter->delivered));
+  janet_struct_put(st, janet_ckeywordv("dropped"),
+                   janet_wrap_number((double) filter->dropped));
+  janet_struct_put(st, janet_ckeywordv("paused"),
+                   janet_wrap_boolean(filter->paused));
+
+  return janet_wrap_struct(janet_struct_end(st));
+}
+
+JanetRegExt cfuns_filter[] = {
+  JANET_REG("match-stats", cfun_match_stats), JANET_REG_END
+};
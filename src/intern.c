@@ -0,0 +1,119 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Joshua Krusell
+
+#include "common.h"
+
+// Strings longer than this are always allocated
+#define INTERN_MAX_LEN 64
+
+#define INTERN_DEFAULT_SIZE 1024
+#define INTERN_MAX_SIZE     (1 << 20)
+
+// Per-thread direct-mapped cache of short strings read from messages.
+// Each string hashes to a single slot and replaces whatever occupied
+// it on a miss, so the cache is bounded by its slot count.
+static JANET_THREAD_LOCAL struct {
+  JanetArray *slots; // Cached strings, rooted while the cache exists
+  int32_t size;      // Number of slots, a power of two or 0 if disabled
+  uint64_t hits;
+  uint64_t misses;
+} g_intern = { .size = INTERN_DEFAULT_SIZE };
+
+static void intern_init(int32_t size) {
+  if (g_intern.slots) {
+    janet_gcunroot(janet_wrap_array(g_intern.slots));
+    g_intern.slots = NULL;
+  }
+
+  g_intern.size = size;
+  if (size == 0)
+    return;
+
+  g_intern.slots = janet_array(size);
+  janet_array_setcount(g_intern.slots, size);
+  for (int32_t i = 0; i < size; i++)
+    g_intern.slots->data[i] = janet_wrap_nil();
+
+  janet_gcroot(janet_wrap_array(g_intern.slots));
+}
+
+Janet intern_string(const char *str) {
+  size_t len = strlen(str);
+  if (g_intern.size == 0 || len > INTERN_MAX_LEN) {
+    g_decode_allocs++;
+    return janet_stringv((const uint8_t *) str, (int32_t) len);
+  }
+
+  if (!g_intern.slots)
+    intern_init(g_intern.size);
+
+  int32_t hash = janet_string_calchash((const uint8_t *) str, (int32_t) len);
+  Janet *slot  = &g_intern.slots->data[(uint32_t) hash & (g_intern.size - 1)];
+
+  if (janet_checktype(*slot, JANET_STRING)) {
+    JanetString cached = janet_unwrap_string(*slot);
+    if (janet_string_length(cached) == (int32_t) len &&
+        memcmp(cached, str, len) == 0) {
+      g_intern.hits++;
+      return *slot;
+    }
+  }
+
+  g_intern.misses++;
+  g_decode_allocs++;
+  *slot = janet_stringv((const uint8_t *) str, (int32_t) len);
+
+  return *slot;
+}
+
+JANET_FN(cfun_intern_stats, "(sdbus/intern-stats &opt reset)",
+         "Return a struct with the number of `:hits` and `:misses` of the "
+         "per-thread string cache used when reading messages, along with "
+         "its `:size` in slots and the number of `:used` slots. If `reset` "
+         "is truthy, the counters are zeroed after reading.") {
+  janet_arity(argc, 0, 1);
+
+  int32_t used = 0;
+  if (g_intern.slots) {
+    for (int32_t i = 0; i < g_intern.size; i++)
+      used += !janet_checktype(g_intern.slots->data[i], JANET_NIL);
+  }
+
+  JanetKV *st = janet_struct_begin(4);
+  janet_struct_put(st, janet_ckeywordv("hits"),
+                   janet_wrap_number((double) g_intern.hits));
+  janet_struct_put(st, janet_ckeywordv("misses"),
+                   janet_wrap_number((double) g_intern.misses));
+  janet_struct_put(st, janet_ckeywordv("size"),
+                   janet_wrap_integer(g_intern.size));
+  janet_struct_put(st, janet_ckeywordv("used"), janet_wrap_integer(used));
+
+  if (argc == 1 && janet_truthy(argv[0]))
+    g_intern.hits = g_intern.misses = 0;
+
+  return janet_wrap_struct(janet_struct_end(st));
+}
+
+JANET_FN(cfun_intern_resize, "(sdbus/intern-resize size)",
+         "Resize the per-thread string cache used when reading messages. "
+         "`size` is rounded up to a power of two, and a size of 0 disables "
+         "the cache. Resizing discards all cached strings.") {
+  janet_fixarity(argc, 1);
+
+  int32_t n = janet_getinteger(argv, 0);
+  if (n < 0 || n > INTERN_MAX_SIZE)
+    janet_panicf("expected cache size between 0 and %d", INTERN_MAX_SIZE);
+
+  int32_t size = (n > 0) ? 1 : 0;
+  while (size && size < n)
+    size <<= 1;
+
+  intern_init(size);
+
+  return janet_wrap_nil();
+}
+
+JanetRegExt cfuns_intern[] = {
+  JANET_REG("intern-resize", cfun_intern_resize),
+  JANET_REG("intern-stats", cfun_intern_stats), JANET_REG_END
+};
@@ -0,0 +1,207 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Joshua Krusell
+
+#include "common.h"
+
+// Iterator over the elements of an array in a message. The array
+// container is entered once and elements are decoded one at a time,
+// so only the current element is held in memory.
+typedef struct MessageIterator {
+  sd_bus_message *msg;          // Iterated message
+  uint64_t flags;               // Decoder flags
+  bool dict;                    // Elements are dictionary entries
+  bool done;                    // Array container has been exited
+  bool moved;                   // Read cursor was moved by others
+  int32_t index;                // Ordinal of the current element
+  Janet current;                // Current element
+  struct MessageIterator *next; // Next active iterator on this thread
+} MessageIterator;
+
+// Iterators which have not finished, checked whenever the read cursor
+// of a message is moved elsewhere
+static JANET_THREAD_LOCAL MessageIterator *g_iterators;
+
+static int dbus_iterator_gc(void *, size_t);
+static int dbus_iterator_gcmark(void *, size_t);
+static int dbus_iterator_get(void *, Janet, Janet *);
+static Janet dbus_iterator_next(void *, Janet);
+const JanetAbstractType dbus_iterator_type = {
+  .name   = "sdbus/message-iterator",
+  .gc     = dbus_iterator_gc,
+  .gcmark = dbus_iterator_gcmark,
+  .get    = dbus_iterator_get,
+  .next   = dbus_iterator_next,
+  JANET_ATEND_NEXT
+};
+
+static void iterator_remove(MessageIterator *iter) {
+  for (MessageIterator **p = &g_iterators; *p; p = &(*p)->next) {
+    if (*p == iter) {
+      *p = iter->next;
+      break;
+    }
+  }
+}
+
+void iterator_invalidate(sd_bus_message *msg) {
+  MessageIterator **p = &g_iterators;
+  while (*p) {
+    MessageIterator *iter = *p;
+    if (!msg || iter->msg == msg) {
+      iter->moved = true;
+      *p          = iter->next;
+    } else {
+      p = &iter->next;
+    }
+  }
+}
+
+static int dbus_iterator_gc(void *p, size_t size) {
+  UNUSED(size);
+
+  MessageIterator *iter = p;
+  iterator_remove(iter);
+
+  sd_bus_message_unrefp(&iter->msg);
+  iter->msg = NULL;
+
+  return 0;
+}
+
+static int dbus_iterator_gcmark(void *p, size_t size) {
+  UNUSED(size);
+
+  MessageIterator *iter = p;
+  janet_mark(iter->current);
+
+  return 0;
+}
+
+static int dbus_iterator_get(void *p, Janet key, Janet *out) {
+  MessageIterator *iter = p;
+  if (iter->done || iter->index < 0 || !janet_checkint(key) ||
+      janet_unwrap_integer(key) != iter->index)
+    return 0;
+
+  *out = iter->current;
+  return 1;
+}
+
+// Decode a dictionary entry as a `[key value]` tuple
+static Janet read_entry(Decoder *d, const char *contents) {
+  CALL_SD_BUS_FUNC(sd_bus_message_enter_container, d->msg,
+                   SD_BUS_TYPE_DICT_ENTRY, contents);
+
+  Janet key = read_dict_key(d, contents[0]);
+
+  Janet value;
+  if (read_complete_type(d, &value) == 0)
+    janet_panic("Unexpected end of dictionary entry");
+
+  CALL_SD_BUS_FUNC(sd_bus_message_exit_container, d->msg);
+
+  g_decode_allocs++;
+  return janet_wrap_tuple(TUPLE(key, value));
+}
+
+// Decode the next element, exiting the array container at its end.
+// Returns false once all elements have been read.
+static bool read_next(MessageIterator *iter) {
+  char type;
+  const char *contents = NULL;
+  if (CALL_SD_BUS_FUNC(sd_bus_message_peek_type, iter->msg, &type,
+                       &contents) == 0) {
+    CALL_SD_BUS_FUNC(sd_bus_message_exit_container, iter->msg);
+    iterator_remove(iter);
+
+    iter->done    = true;
+    iter->current = janet_wrap_nil();
+    return false;
+  }
+
+  // Views of the message must re-navigate after the cursor moves
+  view_cursor_release(iter->msg);
+
+  Decoder d = { .msg = iter->msg, .flags = iter->flags };
+  if (iter->dict)
+    iter->current = read_entry(&d, contents);
+  else
+    read_complete_type(&d, &iter->current);
+
+  decoder_deinit(&d);
+
+  iter->index++;
+  return true;
+}
+
+static Janet dbus_iterator_next(void *p, Janet key) {
+  MessageIterator *iter = p;
+  if (iter->done)
+    return janet_wrap_nil();
+
+  // Elements are consumed as they are read, so iteration may only
+  // continue from the current element
+  bool resume = janet_checktype(key, JANET_NIL)
+                    ? iter->index == -1
+                    : janet_checkint(key) &&
+                          janet_unwrap_integer(key) == iter->index;
+  if (!resume)
+    janet_panicf("message iterator cannot resume from key %v", key);
+
+  if (iter->moved)
+    janet_panic("message read cursor moved during iteration");
+
+  return read_next(iter) ? janet_wrap_integer(iter->index) : janet_wrap_nil();
+}
+
+JANET_FN(cfun_message_each, "(sdbus/message-each msg &opt flags)",
+         "Iterate over the array at the read cursor of `msg` one element "
+         "at a time. Returns an iterator for use with `each`, `map`, and "
+         "other functions taking a data structure, which yields the "
+         "decoded elements of the array in order. Dictionary entries are "
+         "yielded as `[key value]` tuples.\n\n"
+         "Unlike `sdbus/message-read`, only the current element is kept "
+         "in memory. The iterator owns the read cursor while active and "
+         "raises an error if the cursor is moved by another read or "
+         "`sdbus/message-rewind` before iteration finishes. Once all "
+         "elements have been read, the cursor is left after the array. "
+         "`flags` are the same as for `sdbus/message-read`.") {
+  janet_arity(argc, 1, 2);
+
+  sd_bus_message **msg_ptr = janet_getabstract(argv, 0, &dbus_message_type);
+
+  uint64_t flags = 0;
+  if (argc == 2 && !janet_checktype(argv[1], JANET_NIL))
+    flags = janet_getflags(argv, 1, DECODE_FLAGS);
+
+  char type;
+  const char *contents = NULL;
+  if (CALL_SD_BUS_FUNC(sd_bus_message_peek_type, *msg_ptr, &type,
+                       &contents) == 0)
+    janet_panic("Unexpected end of message");
+
+  if (type != SD_BUS_TYPE_ARRAY)
+    janet_panicf("expected array at read cursor, got '%c'", type);
+
+  MessageIterator *iter =
+      janet_abstract(&dbus_iterator_type, sizeof(MessageIterator));
+
+  *iter = (MessageIterator) { .msg     = sd_bus_message_ref(*msg_ptr),
+                              .flags   = flags,
+                              .dict    = contents[0] ==
+                                      SD_BUS_TYPE_DICT_ENTRY_BEGIN,
+                              .index   = -1,
+                              .current = janet_wrap_nil() };
+
+  CALL_SD_BUS_FUNC(sd_bus_message_enter_container, *msg_ptr, type, contents);
+  view_cursor_reset(*msg_ptr);
+
+  iter->next  = g_iterators;
+  g_iterators = iter;
+
+  return janet_wrap_abstract(iter);
+}
+
+JanetRegExt cfuns_iterator[] = {
+  JANET_REG("message-each", cfun_message_each), JANET_REG_END
+};
@@ -0,0 +1,390 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Joshua Krusell
+
+#include "common.h"
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+
+#define MESSAGE_PEEK(msg, type, contents)                                      \
+  CALL_SD_BUS_FUNC(sd_bus_message_peek_type, (msg), (type), (contents))
+
+// Flags controlling the JSON representation
+enum {
+  JSON_HEADERS = 1 << 0, // Wrap the body in an object with header fields
+  JSON_VALUES  = 1 << 1, // Variants as their bare value
+  JSON_STRINGS = 1 << 2, // 64-bit integers as strings
+  JSON_BASE64  = 1 << 3  // Byte arrays as base64 strings
+};
+
+#define JSON_FLAGS "hvsb"
+
+typedef struct {
+  sd_bus_message *msg;
+  uint64_t flags;
+  JanetBuffer *out;
+} JsonWriter;
+
+static void write_value(JsonWriter *, char, const char *);
+
+static void write_string(JanetBuffer *out, const char *str) {
+  static const char hex[] = "0123456789abcdef";
+
+  janet_buffer_push_u8(out, '"');
+
+  // D-Bus strings are valid UTF-8, so only quotes, backslashes, and
+  // control characters need escaping
+  const char *run = str;
+  for (const char *p = str; *p; p++) {
+    uint8_t c = (uint8_t) *p;
+    if (c >= 0x20 && c != '"' && c != '\\')
+      continue;
+
+    janet_buffer_push_bytes(out, (const uint8_t *) run, (int32_t) (p - run));
+    run = p + 1;
+
+    switch (c) {
+      case '"':
+        janet_buffer_push_cstring(out, "\\\"");
+        break;
+      case '\\':
+        janet_buffer_push_cstring(out, "\\\\");
+        break;
+      case '\n':
+        janet_buffer_push_cstring(out, "\\n");
+        break;
+      case '\r':
+        janet_buffer_push_cstring(out, "\\r");
+        break;
+      case '\t':
+        janet_buffer_push_cstring(out, "\\t");
+        break;
+      default: {
+        uint8_t esc[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+        janet_buffer_push_bytes(out, esc, sizeof(esc));
+      }
+    }
+  }
+
+  janet_buffer_push_cstring(out, run);
+  janet_buffer_push_u8(out, '"');
+}
+
+static void write_base64(JanetBuffer *out, const uint8_t *data, size_t len) {
+  static const char table[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+  janet_buffer_push_u8(out, '"');
+  janet_buffer_ensure(out, out->count + (int32_t) ((len + 2) / 3 * 4), 2);
+
+  for (size_t i = 0; i < len; i += 3) {
+    uint32_t n = (uint32_t) data[i] << 16;
+    if (i + 1 < len)
+      n |= (uint32_t) data[i + 1] << 8;
+    if (i + 2 < len)
+      n |= data[i + 2];
+
+    uint8_t chunk[4] = { table[(n >> 18) & 63], table[(n >> 12) & 63],
+                         i + 1 < len ? table[(n >> 6) & 63] : '=',
+                         i + 2 < len ? table[n & 63] : '=' };
+    janet_buffer_push_bytes(out, chunk, 4);
+  }
+
+  janet_buffer_push_u8(out, '"');
+}
+
+// Write a basic value, quoted if it is used as an object key
+static void write_basic(JsonWriter *w, char type, bool quoted) {
+  union {
+    uint8_t y;
+    int16_t n;
+    uint16_t q;
+    int32_t i;
+    uint32_t u;
+    int64_t x;
+    uint64_t t;
+    double d;
+    int b;
+    const char *s;
+  } value;
+
+  CALL_SD_BUS_FUNC(sd_bus_message_read_basic, w->msg, type, &value);
+
+  char buf[32];
+  bool quote = quoted;
+  switch (type) {
+    case 's':
+    case 'o':
+    case 'g':
+      write_string(w->out, value.s);
+      return;
+    case 'h':
+      // File descriptors are only meaningful within this process
+      janet_buffer_push_cstring(w->out, quoted ? "\"null\"" : "null");
+      return;
+    case 'b':
+      snprintf(buf, sizeof(buf), "%s", value.b ? "true" : "false");
+      break;
+    case 'y':
+      snprintf(buf, sizeof(buf), "%" PRIu8, value.y);
+      break;
+    case 'n':
+      snprintf(buf, sizeof(buf), "%" PRId16, value.n);
+      break;
+    case 'q':
+      snprintf(buf, sizeof(buf), "%" PRIu16, value.q);
+      break;
+    case 'i':
+      snprintf(buf, sizeof(buf), "%" PRId32, value.i);
+      break;
+    case 'u':
+      snprintf(buf, sizeof(buf), "%" PRIu32, value.u);
+      break;
+    case 'x':
+      snprintf(buf, sizeof(buf), "%" PRId64, value.x);
+      quote |= (w->flags & JSON_STRINGS) != 0;
+      break;
+    case 't':
+      snprintf(buf, sizeof(buf), "%" PRIu64, value.t);
+      quote |= (w->flags & JSON_STRINGS) != 0;
+      break;
+    case 'd':
+      // JSON has no representation for NaN or infinities
+      if (isfinite(value.d))
+        snprintf(buf, sizeof(buf), "%.17g", value.d);
+      else
+        snprintf(buf, sizeof(buf), "null");
+      break;
+    default:
+      janet_panicf("Unsupported basic type: %c", type);
+  }
+
+  if (quote)
+    janet_buffer_push_u8(w->out, '"');
+
+  janet_buffer_push_cstring(w->out, buf);
+
+  if (quote)
+    janet_buffer_push_u8(w->out, '"');
+}
+
+// Write the remaining complete types in the current container,
+// separated by commas
+static void write_sequence(JsonWriter *w) {
+  char type;
+  const char *contents = NULL;
+  for (int n = 0; MESSAGE_PEEK(w->msg, &type, &contents) > 0; n++) {
+    if (n > 0)
+      janet_buffer_push_u8(w->out, ',');
+
+    write_value(w, type, contents);
+  }
+}
+
+static void write_dict(JsonWriter *w, const char *contents) {
+  janet_buffer_push_u8(w->out, '{');
+
+  char type;
+  const char *entry = NULL;
+  for (int n = 0; MESSAGE_PEEK(w->msg, &type, &entry) > 0; n++) {
+    if (n > 0)
+      janet_buffer_push_u8(w->out, ',');
+
+    CALL_SD_BUS_FUNC(sd_bus_message_enter_container, w->msg, type, entry);
+
+    // Object keys must be strings
+    write_basic(w, contents[1], true);
+    janet_buffer_push_u8(w->out, ':');
+
+    const char *value = NULL;
+    MESSAGE_PEEK(w->msg, &type, &value);
+    write_value(w, type, value);
+
+    CALL_SD_BUS_FUNC(sd_bus_message_exit_container, w->msg);
+  }
+
+  janet_buffer_push_u8(w->out, '}');
+}
+
+static void write_array(JsonWriter *w, const char *contents) {
+  // Byte arrays are read in a single step when encoded as base64
+  if (contents[0] == SD_BUS_TYPE_BYTE && (w->flags & JSON_BASE64)) {
+    const void *ptr = NULL;
+    size_t size     = 0;
+    CALL_SD_BUS_FUNC(sd_bus_message_read_array, w->msg, SD_BUS_TYPE_BYTE,
+                     &ptr, &size);
+
+    write_base64(w->out, ptr, size);
+    return;
+  }
+
+  CALL_SD_BUS_FUNC(sd_bus_message_enter_container, w->msg, SD_BUS_TYPE_ARRAY,
+                   contents);
+
+  if (contents[0] == SD_BUS_TYPE_DICT_ENTRY_BEGIN) {
+    write_dict(w, contents);
+  } else {
+    janet_buffer_push_u8(w->out, '[');
+    write_sequence(w);
+    janet_buffer_push_u8(w->out, ']');
+  }
+
+  CALL_SD_BUS_FUNC(sd_bus_message_exit_container, w->msg);
+}
+
+static void write_value(JsonWriter *w, char type, const char *contents) {
+  if (is_basic_type(type)) {
+    write_basic(w, type, false);
+    return;
+  }
+
+  switch (type) {
+    case SD_BUS_TYPE_ARRAY:
+      write_array(w, contents);
+      return;
+    case SD_BUS_TYPE_STRUCT:
+      CALL_SD_BUS_FUNC(sd_bus_message_enter_container, w->msg, type, contents);
+      janet_buffer_push_u8(w->out, '[');
+      write_sequence(w);
+      janet_buffer_push_u8(w->out, ']');
+      CALL_SD_BUS_FUNC(sd_bus_message_exit_container, w->msg);
+      return;
+    case SD_BUS_TYPE_VARIANT: {
+      CALL_SD_BUS_FUNC(sd_bus_message_enter_container, w->msg, type, contents);
+
+      // Variants mirror the `[signature value]` tuples of message-read
+      bool tagged = !(w->flags & JSON_VALUES);
+      if (tagged) {
+        janet_buffer_push_u8(w->out, '[');
+        write_string(w->out, contents);
+        janet_buffer_push_u8(w->out, ',');
+      }
+
+      char inner;
+      const char *inner_contents = NULL;
+      if (MESSAGE_PEEK(w->msg, &inner, &inner_contents) == 0)
+        janet_panic("Unexpected end of variant type");
+
+      write_value(w, inner, inner_contents);
+
+      if (tagged)
+        janet_buffer_push_u8(w->out, ']');
+
+      CALL_SD_BUS_FUNC(sd_bus_message_exit_container, w->msg);
+      return;
+    }
+  }
+
+  janet_panicf("Unsupported message type: %c", type);
+}
+
+static const char *message_type_name(uint8_t type) {
+  switch (type) {
+    case SD_BUS_MESSAGE_METHOD_CALL:
+      return "method_call";
+    case SD_BUS_MESSAGE_METHOD_RETURN:
+      return "method_return";
+    case SD_BUS_MESSAGE_METHOD_ERROR:
+      return "error";
+    case SD_BUS_MESSAGE_SIGNAL:
+      return "signal";
+    default:
+      return "invalid";
+  }
+}
+
+static void write_field(JanetBuffer *out, const char *name, const char *str) {
+  if (!str)
+    return;
+
+  write_string(out, name);
+  janet_buffer_push_u8(out, ':');
+  write_string(out, str);
+  janet_buffer_push_u8(out, ',');
+}
+
+static void write_headers(JsonWriter *w) {
+  sd_bus_message *msg = w->msg;
+  JanetBuffer *out    = w->out;
+
+  uint8_t type;
+  CALL_SD_BUS_FUNC(sd_bus_message_get_type, msg, &type);
+
+  janet_buffer_push_u8(out, '{');
+  write_field(out, "type", message_type_name(type));
+
+  char buf[32];
+  uint64_t cookie;
+  if (sd_bus_message_get_cookie(msg, &cookie) >= 0) {
+    snprintf(buf, sizeof(buf), "\"cookie\":%" PRIu64 ",", cookie);
+    janet_buffer_push_cstring(out, buf);
+  }
+
+  if (sd_bus_message_get_reply_cookie(msg, &cookie) >= 0) {
+    snprintf(buf, sizeof(buf), "\"reply_cookie\":%" PRIu64 ",", cookie);
+    janet_buffer_push_cstring(out, buf);
+  }
+
+  const sd_bus_error *error = sd_bus_message_get_error(msg);
+
+  write_field(out, "sender", sd_bus_message_get_sender(msg));
+  write_field(out, "destination", sd_bus_message_get_destination(msg));
+  write_field(out, "path", sd_bus_message_get_path(msg));
+  write_field(out, "interface", sd_bus_message_get_interface(msg));
+  write_field(out, "member", sd_bus_message_get_member(msg));
+  write_field(out, "error", error ? error->name : NULL);
+  write_field(out, "signature", sd_bus_message_get_signature(msg, true));
+
+  janet_buffer_push_cstring(out, "\"body\":");
+}
+
+JANET_FN(cfun_message_to_json, "(sdbus/message->json msg &opt flags buffer)",
+         "Encode the contents of a message as JSON, written directly to "
+         "`buffer` without creating intermediate Janet values. Returns "
+         "the buffer, a new one if not given.\n\n"
+         "The message body is written as an array of its arguments. "
+         "Structs become arrays, dictionaries become objects with keys "
+         "converted to strings, and variants become `[signature, value]` "
+         "arrays. Doubles which are not finite and file descriptors are "
+         "written as null. `flags` is a combination of:\n\n"
+         "* `:h` - Wrap the body in an object with the message header "
+         "fields, with the arguments under `\"body\"`.\n"
+         "* `:v` - Write variants as their bare value.\n"
+         "* `:s` - Write 64-bit integers as strings, since many JSON "
+         "parsers cannot represent them exactly.\n"
+         "* `:b` - Write byte arrays as base64 strings.\n\n"
+         "The read cursor of `msg` is rewound.") {
+  janet_arity(argc, 1, 3);
+
+  sd_bus_message **msg_ptr = janet_getabstract(argv, 0, &dbus_message_type);
+
+  uint64_t flags = 0;
+  if (argc >= 2 && !janet_checktype(argv[1], JANET_NIL))
+    flags = janet_getflags(argv, 1, JSON_FLAGS);
+
+  JanetBuffer *out = janet_optbuffer(argv, argc, 2, 256);
+
+  JsonWriter w = { .msg = *msg_ptr, .flags = flags, .out = out };
+
+  view_cursor_reset(w.msg);
+  CALL_SD_BUS_FUNC(sd_bus_message_rewind, w.msg, true);
+
+  if (flags & JSON_HEADERS)
+    write_headers(&w);
+
+  janet_buffer_push_u8(out, '[');
+  write_sequence(&w);
+  janet_buffer_push_u8(out, ']');
+
+  if (flags & JSON_HEADERS)
+    janet_buffer_push_u8(out, '}');
+
+  CALL_SD_BUS_FUNC(sd_bus_message_rewind, w.msg, true);
+
+  return janet_wrap_buffer(out);
+}
+
+JanetRegExt cfuns_json[] = {
+  JANET_REG("message->json", cfun_message_to_json), JANET_REG_END
+};
@@ -11,9 +11,19 @@ int check_sd_bus_return(const char *function, int rv) {
 }
 
 JANET_MODULE_ENTRY(JanetTable *env) {
+  janet_cfuns_ext(env, "sdbus", cfuns_blob);
   janet_cfuns_ext(env, "sdbus", cfuns_bus);
   janet_cfuns_ext(env, "sdbus", cfuns_call);
+  janet_cfuns_ext(env, "sdbus", cfuns_capture);
   janet_cfuns_ext(env, "sdbus", cfuns_export);
+  janet_cfuns_ext(env, "sdbus", cfuns_intern);
+  janet_cfuns_ext(env, "sdbus", cfuns_iterator);
+  janet_cfuns_ext(env, "sdbus", cfuns_json);
   janet_cfuns_ext(env, "sdbus", cfuns_message);
+  janet_cfuns_ext(env, "sdbus", cfuns_pool);
+  janet_cfuns_ext(env, "sdbus", cfuns_filter);
+  janet_cfuns_ext(env, "sdbus", cfuns_signature);
   janet_cfuns_ext(env, "sdbus", cfuns_slot);
+  janet_cfuns_ext(env, "sdbus", cfuns_template);
+  janet_cfuns_ext(env, "sdbus", cfuns_view);
 }
@@ -10,22 +10,33 @@
 #define DBUS_TO_JANET_NUM(janet_type, c_type, dbus_type)                       \
   do {                                                                         \
     c_type x;                                                                  \
-    CALL_SD_BUS_FUNC(sd_bus_message_read_basic, msg, dbus_type, &x);           \
+    CALL_SD_BUS_FUNC(sd_bus_message_read_basic, d->msg, dbus_type, &x);        \
     return janet_wrap_##janet_type(x);                                         \
   } while (0)
 
 #define DBUS_TO_JANET_STR(dbus_type)                                           \
   do {                                                                         \
     const char *x;                                                             \
-    CALL_SD_BUS_FUNC(sd_bus_message_read_basic, msg, dbus_type, &x);           \
-    return janet_cstringv(x);                                                  \
+    CALL_SD_BUS_FUNC(sd_bus_message_read_basic, d->msg, dbus_type, &x);        \
+    return intern_string(x);                                                   \
   } while (0)
 
-// State struct when parsing signatures and appending data
-typedef struct {
+// State struct when appending data per a compiled signature
+typedef struct Encoder {
   sd_bus_message *msg;
-  const char *cursor;
-} Parser;
+  const Signature *sig;
+  struct Encoder *parent; // Encoder of the enclosing variant, if any
+} Encoder;
+
+// Source of array elements or dictionary entries produced one at a
+// time, either by resuming a fiber or by calling `next`
+typedef struct {
+  Janet source;
+  Janet key; // Last key returned by `next`
+} Stream;
+
+// Number of Janet values allocated while decoding
+JANET_THREAD_LOCAL uint64_t g_decode_allocs;
 
 static int gc_sdbus_message(void *, size_t);
 const JanetAbstractType dbus_message_type = { .name = "sdbus/message",
@@ -41,244 +52,325 @@ static int gc_sdbus_message(void *data, size_t len) {
   return 0;
 }
 
-static bool is_basic_type(int ch) {
-  return strchr("ybnqiuxtdsogh", ch) != NULL;
-}
+static void append_complete_type(Encoder *, const SignatureNode *, Janet);
+static void append_basic_type(Encoder *, int, Janet);
+static void append_variant_type(Encoder *, Janet);
+static void append_struct_type(Encoder *, const SignatureNode *, Janet);
+static void append_array_type(Encoder *, const SignatureNode *, Janet);
+static void append_dict_type(Encoder *, const SignatureNode *, Janet);
 
-static int skip(Parser *p, size_t skip) {
-  p->cursor += skip;
-  return *p->cursor;
-}
+void append_data(sd_bus_message *msg, const Signature *sig, Janet *args,
+                 int32_t n) {
+  dbus_errctx_reset();
 
-static int next(Parser *p) {
-  return *(++p->cursor);
-}
+  Encoder e                 = { msg, sig, NULL };
+  const SignatureNode *node = sig->nodes, *end = sig->nodes + sig->count;
+  for (int32_t i = 0; i < n; i++) {
+    if (node == end)
+      janet_panicf("Excessive arguments for signature: %s", sig->signature);
 
-static int peek(Parser *p) {
-  return *(p->cursor + 1);
-}
+    dbus_errctx_inc();
+    append_complete_type(&e, node, args[i]);
+    node = sig->nodes + node->next;
+  }
 
-static int cursor(Parser *p) {
-  return *p->cursor;
+  if (node != end)
+    janet_panicf("Arguments missing for signature: %s", sig->signature);
 }
 
-// Returns offset of matching 'close' character in str
-static size_t match(const char *str, int open, int close) {
-  int depth     = 1;
-  size_t length = 0;
-
-  int ch;
-  while ((ch = *++str)) {
-    if (ch == open)
-      depth++;
-    else if (ch == close)
-      depth--;
+static void append_complete_type(Encoder *e, const SignatureNode *node,
+                                 Janet arg) {
+  dbus_errctx_set(node->sig, node->len);
 
-    length++;
-    if (depth == 0)
-      return length;
+  switch (node->type) {
+    case SD_BUS_TYPE_VARIANT:
+      append_variant_type(e, arg);
+      break;
+    case SD_BUS_TYPE_STRUCT_BEGIN:
+      append_struct_type(e, node, arg);
+      break;
+    case SD_BUS_TYPE_ARRAY:
+      append_array_type(e, node, arg);
+      break;
+    case SD_BUS_TYPE_DICT_ENTRY_BEGIN:
+      append_dict_type(e, node, arg);
+      break;
+    default:
+      append_basic_type(e, node->type, arg);
+      break;
   }
 
-  janet_panicf("Unmatched %c in signature", open);
-}
-
-// Returns offset to the start of the first complete type or
-// dictionary entry in signature. Used to find the member type for
-// arrays.
-static size_t find_subtype(const char *signature) {
-  int ch;
-  if (!(ch = *signature))
-    janet_panic("Missing array signature");
-
-  if (ch == 'a')
-    return 1 + find_subtype(signature + 1);
-  else if (ch == '{')
-    return match(signature, '{', '}');
-  else if (ch == '(')
-    return match(signature, '(', ')');
-  else
-    return 0;
+  dbus_errctx_exit();
 }
 
-// Returns the length of the next complete type
-static size_t span_next_type(Parser *p) {
-  if (!p->cursor)
-    return 0;
+static bool is_stream(Janet arg) {
+  if (janet_checktype(arg, JANET_FIBER))
+    return true;
 
-  int ch = cursor(p);
-  if (is_basic_type(ch) || ch == 'v')
-    return 1;
-  else if (ch == 'a')
-    return 1 + find_subtype(p->cursor);
-  else if (ch == '(')
-    return match(p->cursor, '(', ')');
-  else
-    janet_panicf("Unsupported argument type: %c", ch);
+  return janet_checktype(arg, JANET_ABSTRACT) &&
+         janet_abstract_type(janet_unwrap_abstract(arg))->next;
 }
 
-static void append_complete_type(Parser *, Janet);
-static void append_basic_type(Parser *, Janet);
-static void append_variant_type(Parser *, Janet);
-static void append_struct_type(Parser *, Janet);
-static void append_array_type(Parser *, Janet);
-static void append_dict_type(Parser *, Janet);
-
-static void append_data(sd_bus_message *msg, const char *signature, Janet *args,
-                        int32_t n) {
-  dbus_errctx_reset();
-
-  Parser p = { msg, signature };
-  for (int32_t i = 0; i < n; i++) {
-    if (!cursor(&p))
-      janet_panicf("Excessive arguments for signature: %s", signature);
-
-    dbus_errctx_inc();
-    append_complete_type(&p, args[i]);
-    next(&p);
+// Produce the next value from a stream. For fibers, each yielded value
+// is an element and `key` is nil. Returns false at the end of the
+// stream.
+static bool stream_next(Stream *s, Janet *key, Janet *value) {
+  if (!janet_checktype(s->source, JANET_FIBER)) {
+    s->key = janet_next(s->source, s->key);
+    if (janet_checktype(s->key, JANET_NIL))
+      return false;
+
+    *key   = s->key;
+    *value = janet_in(s->source, s->key);
+    return true;
   }
 
-  if (cursor(&p))
-    janet_panicf("Arguments missing for signature: %s", signature);
+  JanetFiber *fiber = janet_unwrap_fiber(s->source);
+  if (janet_fiber_status(fiber) == JANET_STATUS_DEAD)
+    return false;
+
+  // The fiber may itself append to other messages
+  ErrorContext ctx = dbus_errctx_save();
+  JanetSignal sig  = janet_continue(fiber, janet_wrap_nil(), value);
+  dbus_errctx_restore(ctx);
+
+  *key = janet_wrap_nil();
+  switch (sig) {
+    case JANET_SIGNAL_YIELD:
+      return true;
+    case JANET_SIGNAL_OK:
+      return false;
+    case JANET_SIGNAL_ERROR:
+      janet_panicv(*value);
+    default:
+      janet_panicf("unexpected signal from array generator: %v", *value);
+  }
 }
 
-static void append_complete_type(Parser *p, Janet arg) {
-  dbus_errctx_set(p->cursor, span_next_type(p));
+static void append_dict_entry(Encoder *e, const SignatureNode *node,
+                              Janet key, Janet value) {
+  CALL_SD_BUS_FUNC(sd_bus_message_open_container, e->msg,
+                   SD_BUS_TYPE_DICT_ENTRY, node->entry);
 
-  int ch = cursor(p);
-  if (is_basic_type(ch))
-    append_basic_type(p, arg);
-  else if (ch == 'v')
-    append_variant_type(p, arg);
-  else if (ch == '(')
-    append_struct_type(p, arg);
-  else if (ch == 'a')
-    append_array_type(p, arg);
-  else
-    janet_panicf("Unsupported argument type: %c", ch);
+  // Key and value types immediately follow the dictionary node
+  append_basic_type(e, node[1].type, key);
+  append_complete_type(e, node + 2, value);
 
-  dbus_errctx_exit();
+  CALL_SD_BUS_FUNC(sd_bus_message_close_container, e->msg);
 }
 
-static void append_dict_type(Parser *p, Janet arg) {
-  size_t end;
-  if ((end = match(p->cursor, '{', '}')) < 3)
-    janet_panicf("incomplete dictionary signature: %s", p->cursor);
+// Append an array or dictionary from a stream, encoding each element
+// as it is produced so the collection is never held in memory.
+static void append_stream(Encoder *e, const SignatureNode *node, Janet arg) {
+  CALL_SD_BUS_FUNC(sd_bus_message_open_container, e->msg, SD_BUS_TYPE_ARRAY,
+                   node->contents);
+
+  // Producing elements runs arbitrary Janet code. Keep the signatures
+  // being encoded and the current element reachable in the meantime,
+  // since cached signatures may otherwise be evicted and collected.
+  JanetArray *pins = janet_array(4);
+  for (Encoder *p = e; p; p = p->parent)
+    janet_array_push(pins, janet_wrap_abstract((void *) p->sig));
+
+  int32_t slot = pins->count;
+  janet_array_push(pins, janet_wrap_nil());
+  janet_gcroot(janet_wrap_array(pins));
+
+  JanetTryState state;
+  JanetSignal signal = janet_try(&state);
+  if (!signal) {
+    Stream s = { .source = arg, .key = janet_wrap_nil() };
+    Janet key, value;
+    while (stream_next(&s, &key, &value)) {
+      pins->data[slot] = value;
+
+      if (node->type != SD_BUS_TYPE_DICT_ENTRY_BEGIN) {
+        append_complete_type(e, node + 1, value);
+        continue;
+      }
+
+      // Generators yield entries as `[key value]` pairs
+      if (janet_checktype(s.source, JANET_FIBER)) {
+        JanetView pair = getindexed(value);
+        if (pair.len != 2)
+          janet_panicf("expected [key value] dictionary entry, got %v",
+                       value);
+
+        key   = pair.items[0];
+        value = pair.items[1];
+      }
+
+      append_dict_entry(e, node, key, value);
+    }
+  }
 
-  // Opening/closing braces must be included for sd_bus_message_open_container
-  char *dict_sig = janet_scalloc(end + 2, sizeof(char));
-  memcpy(dict_sig, p->cursor, end + 1);
+  janet_restore(&state);
+  janet_gcunroot(janet_wrap_array(pins));
 
-  skip(p, end);
+  if (signal)
+    janet_panicv(state.payload);
 
-  if (!is_basic_type(*(dict_sig + 1)))
-    janet_panicf("dictionary signature key must be a basic type: %s", dict_sig);
+  CALL_SD_BUS_FUNC(sd_bus_message_close_container, e->msg);
+}
 
-  CALL_SD_BUS_FUNC(sd_bus_message_open_container, p->msg, SD_BUS_TYPE_ARRAY,
-                   dict_sig);
+static void append_dict_type(Encoder *e, const SignatureNode *node,
+                             Janet arg) {
+  if (is_stream(arg)) {
+    append_stream(e, node, arg);
+    return;
+  }
 
-  // Strip opening/closing braces
-  memmove(dict_sig, dict_sig + 1, end - 1);
-  dict_sig[end - 1] = '\0';
+  CALL_SD_BUS_FUNC(sd_bus_message_open_container, e->msg, SD_BUS_TYPE_ARRAY,
+                   node->contents);
 
   JanetDictView dict = getdictionary(arg);
   const JanetKV *kv  = NULL;
-  Parser dict_parser = { p->msg, dict_sig };
 
-  while ((kv = janet_dictionary_next(dict.kvs, dict.cap, kv))) {
-    CALL_SD_BUS_FUNC(sd_bus_message_open_container, p->msg,
-                     SD_BUS_TYPE_DICT_ENTRY, dict_sig);
-
-    // Append entry key - basic type
-    append_basic_type(&dict_parser, kv->key);
-
-    // Append entry value - complete type
-    next(&dict_parser);
-    append_complete_type(&dict_parser, kv->value);
+  while ((kv = janet_dictionary_next(dict.kvs, dict.cap, kv)))
+    append_dict_entry(e, node, kv->key, kv->value);
 
-    // Reset cursor back to 'key' type
-    dict_parser.cursor = dict_sig;
+  CALL_SD_BUS_FUNC(sd_bus_message_close_container, e->msg);
+}
 
-    CALL_SD_BUS_FUNC(sd_bus_message_close_container, p->msg);
+// Size in bytes of fixed-width D-Bus types that are laid out
+// contiguously in arrays, or 0 otherwise.
+size_t fixed_type_size(int type) {
+  switch (type) {
+    case 'y':
+      return sizeof(uint8_t);
+    case 'n':
+    case 'q':
+      return sizeof(uint16_t);
+    case 'b': // D-Bus booleans are 32 bits wide on the wire
+    case 'i':
+    case 'u':
+      return sizeof(uint32_t);
+    case 'x':
+    case 't':
+    case 'd':
+      return sizeof(uint64_t);
+    default:
+      return 0;
   }
-
-  CALL_SD_BUS_FUNC(sd_bus_message_close_container, p->msg);
-  janet_sfree(dict_sig);
 }
 
-static void append_array_type(Parser *p, Janet arg) {
-  // Dictionaries
-  if (peek(p) == '{') {
-    next(p);
-    append_dict_type(p, arg);
-    return;
-  }
+#define PACK_ARRAY(c_type, getter)                                             \
+  do {                                                                         \
+    c_type *dst = ptr;                                                         \
+    for (int32_t i = 0; i < array.len; i++)                                    \
+      dst[i] = (c_type) getter(array.items[i]);                                \
+  } while (0)
 
-  // Byte arrays
-  if (peek(p) == 'y') {
-    next(p);
-    JanetByteView view = getbytes(arg);
-    CALL_SD_BUS_FUNC(sd_bus_message_append_array, p->msg, 'y', view.bytes,
+// Append an array of fixed-width values in a single call, either
+// directly from a buffer of native-endian values or by packing an
+// indexed collection straight into the message body.
+static void append_fixed_array(Encoder *e, const SignatureNode *member,
+                               Janet arg) {
+  char type   = member->type;
+  size_t size = fixed_type_size(type);
+
+  JanetByteView view;
+  if ((type == SD_BUS_TYPE_BYTE || janet_checktype(arg, JANET_BUFFER)) &&
+      janet_bytes_view(arg, &view.bytes, &view.len)) {
+    if (view.len % size != 0)
+      janet_panicf("buffer length %d is not a multiple of %d for array "
+                   "type a%c",
+                   view.len, (int32_t) size, type);
+
+    CALL_SD_BUS_FUNC(sd_bus_message_append_array, e->msg, type, view.bytes,
                      (size_t) view.len);
     return;
   }
 
-  size_t end      = find_subtype(p->cursor);
-  char *array_sig = janet_scalloc(end + 1, sizeof(char));
-  memcpy(array_sig, p->cursor + 1, end);
+  JanetView array = getindexed(arg);
 
-  skip(p, end);
+  void *ptr = NULL;
+  CALL_SD_BUS_FUNC(sd_bus_message_append_array_space, e->msg, type,
+                   (size_t) array.len * size, &ptr);
 
-  CALL_SD_BUS_FUNC(sd_bus_message_open_container, p->msg, SD_BUS_TYPE_ARRAY,
-                   array_sig);
+  dbus_errctx_set(member->sig, member->len);
+  switch (type) {
+    case 'y':
+      PACK_ARRAY(uint8_t, getuinteger8);
+      break;
+    case 'n':
+      PACK_ARRAY(int16_t, getinteger16);
+      break;
+    case 'q':
+      PACK_ARRAY(uint16_t, getuinteger16);
+      break;
+    case 'i':
+      PACK_ARRAY(int32_t, getinteger);
+      break;
+    case 'u':
+      PACK_ARRAY(uint32_t, getuinteger);
+      break;
+    case 'x':
+      PACK_ARRAY(int64_t, getinteger64);
+      break;
+    case 't':
+      PACK_ARRAY(uint64_t, getuinteger64);
+      break;
+    case 'd':
+      PACK_ARRAY(double, getnumber);
+      break;
+  }
+  dbus_errctx_exit();
+}
 
-  JanetView array     = getindexed(arg);
-  Parser array_parser = { p->msg, array_sig };
-  for (int32_t i = 0; i < array.len; i++) {
-    append_complete_type(&array_parser, array.items[i]);
+static void append_array_type(Encoder *e, const SignatureNode *node,
+                              Janet arg) {
+  const SignatureNode *member = node + 1;
 
-    // Reset - container types may move our cursor
-    array_parser.cursor = array_sig;
+  if (is_stream(arg)) {
+    append_stream(e, node, arg);
+    return;
   }
 
-  CALL_SD_BUS_FUNC(sd_bus_message_close_container, p->msg);
-  janet_sfree(array_sig);
-}
+  // Byte and numeric arrays. sd-bus does not accept booleans as a
+  // trivial array type, so those are appended one element at a time.
+  if (fixed_type_size(member->type) && member->type != SD_BUS_TYPE_BOOLEAN) {
+    append_fixed_array(e, member, arg);
+    return;
+  }
 
-static void append_struct_type(Parser *p, Janet arg) {
-  size_t end = 0;
-  if ((end = match(p->cursor, '(', ')')) < 2)
-    janet_panicf("Missing struct signature contents: %s", p->cursor);
+  CALL_SD_BUS_FUNC(sd_bus_message_open_container, e->msg, SD_BUS_TYPE_ARRAY,
+                   node->contents);
 
-  // Exclude opening/closing parentheses
-  char *struct_sig = janet_scalloc(end, sizeof(char));
-  memcpy(struct_sig, p->cursor + 1, end - 1);
+  JanetView array = getindexed(arg);
+  for (int32_t i = 0; i < array.len; i++)
+    append_complete_type(e, member, array.items[i]);
 
-  skip(p, end);
+  CALL_SD_BUS_FUNC(sd_bus_message_close_container, e->msg);
+}
 
-  CALL_SD_BUS_FUNC(sd_bus_message_open_container, p->msg, SD_BUS_TYPE_STRUCT,
-                   struct_sig);
+static void append_struct_type(Encoder *e, const SignatureNode *node,
+                               Janet arg) {
+  CALL_SD_BUS_FUNC(sd_bus_message_open_container, e->msg, SD_BUS_TYPE_STRUCT,
+                   node->contents);
 
   JanetView array = getindexed(arg);
   if (array.len == 0)
     janet_panic("Empty struct: missing arguments");
 
-  Parser struct_parser = { p->msg, struct_sig };
+  const SignatureNode *field = node + 1, *end = e->sig->nodes + node->next;
   for (int32_t i = 0; i < array.len; i++) {
-    if (!cursor(&struct_parser))
-      janet_panicf("Excessive arguments for struct signature: %s", struct_sig);
+    if (field == end)
+      janet_panicf("Excessive arguments for struct signature: %s",
+                   node->contents);
 
-    append_complete_type(&struct_parser, array.items[i]);
-    next(&struct_parser);
+    append_complete_type(e, field, array.items[i]);
+    field = e->sig->nodes + field->next;
   }
 
-  if (cursor(&struct_parser))
-    janet_panicf("Arguments missing for struct signature: %s", struct_sig);
+  if (field != end)
+    janet_panicf("Arguments missing for struct signature: %s",
+                 node->contents);
 
-  CALL_SD_BUS_FUNC(sd_bus_message_close_container, p->msg);
-  janet_sfree(struct_sig);
+  CALL_SD_BUS_FUNC(sd_bus_message_close_container, e->msg);
 }
 
-static void append_variant_type(Parser *p, Janet arg) {
+static void append_variant_type(Encoder *e, Janet arg) {
   const Janet *tuple = gettuple(arg);
   if (janet_tuple_length(tuple) != 2)
     janet_panicf("Variant type expects exactly 2 arguments");
@@ -286,161 +378,299 @@ static void append_variant_type(Parser *p, Janet arg) {
   if (!janet_checktype(tuple[0], JANET_STRING))
     janet_panicf("Expected string signature for variant, got %v", tuple[0]);
 
-  const char *variant_sig = janet_getcbytes(tuple, 0);
-  const Janet variant_arg = tuple[1];
-  Parser variant_parser   = { p->msg, variant_sig };
+  JanetString signature        = janet_unwrap_string(tuple[0]);
+  const Signature *variant_sig = signature_lookup(signature);
+  const Janet variant_arg      = tuple[1];
+  Encoder variant_encoder      = { e->msg, variant_sig, e };
 
-  CALL_SD_BUS_FUNC(sd_bus_message_open_container, p->msg, SD_BUS_TYPE_VARIANT,
-                   variant_sig);
-  append_complete_type(&variant_parser, variant_arg);
-  CALL_SD_BUS_FUNC(sd_bus_message_close_container, p->msg);
+  if (variant_sig->nargs != 1)
+    janet_panicf("Variant signature must be a single complete type: %s",
+                 variant_sig->signature);
+
+  CALL_SD_BUS_FUNC(sd_bus_message_open_container, e->msg, SD_BUS_TYPE_VARIANT,
+                   variant_sig->signature);
+  append_complete_type(&variant_encoder, variant_sig->nodes, variant_arg);
+  CALL_SD_BUS_FUNC(sd_bus_message_close_container, e->msg);
 }
 
-static void append_basic_type(Parser *p, Janet arg) {
-  switch (cursor(p)) {
+static void append_basic_type(Encoder *e, int type, Janet arg) {
+  switch (type) {
     case 'y': // byte
-      CALL_SD_BUS_FUNC(sd_bus_message_append, p->msg, "y", getuinteger8(arg));
+      CALL_SD_BUS_FUNC(sd_bus_message_append, e->msg, "y", getuinteger8(arg));
       break;
     case 'b': // boolean
-      CALL_SD_BUS_FUNC(sd_bus_message_append, p->msg, "b", getboolean(arg));
+      CALL_SD_BUS_FUNC(sd_bus_message_append, e->msg, "b", getboolean(arg));
       break;
     case 'n': // int16_t
-      CALL_SD_BUS_FUNC(sd_bus_message_append, p->msg, "n", getinteger16(arg));
+      CALL_SD_BUS_FUNC(sd_bus_message_append, e->msg, "n", getinteger16(arg));
       break;
     case 'q': // uint16_t
-      CALL_SD_BUS_FUNC(sd_bus_message_append, p->msg, "q", getuinteger16(arg));
+      CALL_SD_BUS_FUNC(sd_bus_message_append, e->msg, "q", getuinteger16(arg));
       break;
     case 'i': // int32_t
-      CALL_SD_BUS_FUNC(sd_bus_message_append, p->msg, "i", getinteger(arg));
+      CALL_SD_BUS_FUNC(sd_bus_message_append, e->msg, "i", getinteger(arg));
       break;
     case 'u': // uint32_t
-      CALL_SD_BUS_FUNC(sd_bus_message_append, p->msg, "u", getuinteger(arg));
+      CALL_SD_BUS_FUNC(sd_bus_message_append, e->msg, "u", getuinteger(arg));
       break;
     case 'x': // int64_t
-      CALL_SD_BUS_FUNC(sd_bus_message_append, p->msg, "x", getinteger64(arg));
+      CALL_SD_BUS_FUNC(sd_bus_message_append, e->msg, "x", getinteger64(arg));
       break;
     case 't': // uint64_t
-      CALL_SD_BUS_FUNC(sd_bus_message_append, p->msg, "t", getuinteger64(arg));
+      CALL_SD_BUS_FUNC(sd_bus_message_append, e->msg, "t", getuinteger64(arg));
       break;
     case 'd': // double
-      CALL_SD_BUS_FUNC(sd_bus_message_append, p->msg, "d", getnumber(arg));
+      CALL_SD_BUS_FUNC(sd_bus_message_append, e->msg, "d", getnumber(arg));
       break;
     case 's': // string
     case 'o': // object path
     case 'g': // signature
-      CALL_SD_BUS_FUNC(sd_bus_message_append_basic, p->msg, cursor(p),
+      CALL_SD_BUS_FUNC(sd_bus_message_append_basic, e->msg, type,
                        getcstring(arg));
       break;
     case 'h': // file descriptor
-      CALL_SD_BUS_FUNC(sd_bus_message_append, p->msg, "h", getfd(arg));
+      CALL_SD_BUS_FUNC(sd_bus_message_append, e->msg, "h", getfd(arg));
       break;
   }
 }
 
-static Janet read_basic_type(sd_bus_message *, char);
-static Janet read_variant_type(sd_bus_message *, const char *);
-static Janet read_struct_type(sd_bus_message *, const char *);
-static Janet read_array_type(sd_bus_message *, const char *);
-static Janet read_dict_type(sd_bus_message *, const char *);
+static Janet read_variant_type(Decoder *, const char *);
+static Janet read_struct_type(Decoder *, const char *);
+static Janet read_array_type(Decoder *, const char *);
+static Janet read_dict_type(Decoder *, const char *);
 
 // Returns 1 on success, 0 on end of message
-static int read_complete_type(sd_bus_message *msg, Janet *obj) {
+int read_complete_type(Decoder *d, Janet *obj) {
   char type;                    // Next type in message
   const char *signature = NULL; // Signature of contents if container
 
-  if (MESSAGE_PEEK(msg, &type, &signature) == 0)
+  if (MESSAGE_PEEK(d->msg, &type, &signature) == 0)
     return 0;
 
   if (is_basic_type(type))
-    *obj = read_basic_type(msg, type);
+    *obj = read_basic_type(d, type);
   else if (type == SD_BUS_TYPE_VARIANT)
-    *obj = read_variant_type(msg, signature);
+    *obj = read_variant_type(d, signature);
   else if (type == SD_BUS_TYPE_STRUCT)
-    *obj = read_struct_type(msg, signature);
+    *obj = read_struct_type(d, signature);
   else if (type == 'a' && *signature == '{')
-    *obj = read_dict_type(msg, signature);
+    *obj = read_dict_type(d, signature);
   else if (type == 'a')
-    *obj = read_array_type(msg, signature);
+    *obj = read_array_type(d, signature);
   else
     janet_panicf("Unsupported message type: %c", type);
 
   return 1;
 }
 
-static Janet read_variant_type(sd_bus_message *msg, const char *signature) {
-  CALL_SD_BUS_FUNC(sd_bus_message_enter_container, msg, SD_BUS_TYPE_VARIANT,
+static Janet read_variant_type(Decoder *d, const char *signature) {
+  CALL_SD_BUS_FUNC(sd_bus_message_enter_container, d->msg, SD_BUS_TYPE_VARIANT,
                    signature);
 
   Janet obj;
-  if (read_complete_type(msg, &obj) == 0)
+  if (read_complete_type(d, &obj) == 0)
     janet_panic("Unexpected end of variant type");
 
-  CALL_SD_BUS_FUNC(sd_bus_message_exit_container, msg);
+  CALL_SD_BUS_FUNC(sd_bus_message_exit_container, d->msg);
 
-  JanetTuple tuple = TUPLE(janet_cstringv(signature), obj);
+  JanetTuple tuple = TUPLE(intern_string(signature), obj);
+  g_decode_allocs++;
   return janet_wrap_tuple(tuple);
 }
 
-static Janet read_struct_type(sd_bus_message *msg, const char *signature) {
-  JanetArray *array = janet_array(1);
-
-  CALL_SD_BUS_FUNC(sd_bus_message_enter_container, msg, SD_BUS_TYPE_STRUCT,
+static Janet read_struct_type(Decoder *d, const char *signature) {
+  CALL_SD_BUS_FUNC(sd_bus_message_enter_container, d->msg, SD_BUS_TYPE_STRUCT,
                    signature);
 
-  Janet obj;
-  while (read_complete_type(msg, &obj) > 0)
-    janet_array_push(array, obj);
+  // Field count is fixed by the signature, so fill the tuple in place
+  int32_t n    = (int32_t) signature_count(signature);
+  Janet *tuple = janet_tuple_begin(n);
+  g_decode_allocs++;
+
+  for (int32_t i = 0; i < n; i++) {
+    if (read_complete_type(d, &tuple[i]) == 0)
+      janet_panic("Unexpected end of struct type");
+  }
 
-  CALL_SD_BUS_FUNC(sd_bus_message_exit_container, msg);
+  CALL_SD_BUS_FUNC(sd_bus_message_exit_container, d->msg);
+  return janet_wrap_tuple(janet_tuple_end(tuple));
+}
 
-  JanetTuple tuple = janet_tuple_n(array->data, array->count);
-  return janet_wrap_tuple(tuple);
+// Push a value onto the decoder's scratch stack. Elements of arrays and
+// dictionaries are collected here first since sd-bus does not expose
+// their element count, allowing the final container to be allocated
+// once at its exact size.
+static void stack_push(Decoder *d, Janet value) {
+  if (d->top == d->capacity) {
+    d->capacity = (d->capacity > 0) ? 2 * d->capacity : 32;
+    d->stack    = janet_srealloc(d->stack, d->capacity * sizeof(Janet));
+  }
+
+  d->stack[d->top++] = value;
 }
 
-static Janet read_dict_type(sd_bus_message *msg, const char *signature) {
-  JanetTable *tbl = janet_table(1);
+void decoder_deinit(Decoder *d) {
+  janet_sfree(d->stack);
+  d->stack    = NULL;
+  d->top      = 0;
+  d->capacity = 0;
+}
 
-  CALL_SD_BUS_FUNC(sd_bus_message_enter_container, msg, SD_BUS_TYPE_ARRAY,
+static Janet read_dict_type(Decoder *d, const char *signature) {
+  CALL_SD_BUS_FUNC(sd_bus_message_enter_container, d->msg, SD_BUS_TYPE_ARRAY,
                    signature);
 
+  int32_t base = d->top;
+
   char type;
   const char *dict_sig = NULL;
-  while (MESSAGE_PEEK(msg, &type, &dict_sig) > 0) {
-    CALL_SD_BUS_FUNC(sd_bus_message_enter_container, msg,
+  while (MESSAGE_PEEK(d->msg, &type, &dict_sig) > 0) {
+    CALL_SD_BUS_FUNC(sd_bus_message_enter_container, d->msg,
                      SD_BUS_TYPE_DICT_ENTRY, dict_sig);
 
-    Janet key = read_basic_type(msg, dict_sig[0]);
+    stack_push(d, read_dict_key(d, dict_sig[0]));
+
     Janet value;
-    if (read_complete_type(msg, &value) == 0)
+    if (read_complete_type(d, &value) == 0)
       janet_panic("Unexpected end of dictionary type");
 
-    janet_table_put(tbl, key, value);
+    stack_push(d, value);
+
+    CALL_SD_BUS_FUNC(sd_bus_message_exit_container, d->msg);
+  }
+
+  CALL_SD_BUS_FUNC(sd_bus_message_exit_container, d->msg);
+
+  // Elements may be relocated by nested pushes, so only take a pointer
+  // once the dictionary is fully read.
+  const Janet *kvs = d->stack + base;
+  int32_t n        = (d->top - base) / 2;
+  d->top           = base;
+  g_decode_allocs++;
 
-    CALL_SD_BUS_FUNC(sd_bus_message_exit_container, msg);
+  if (d->flags & DECODE_FROZEN) {
+    JanetKV *st = janet_struct_begin(n);
+    for (int32_t i = 0; i < n; i++)
+      janet_struct_put(st, kvs[2 * i], kvs[2 * i + 1]);
+
+    return janet_wrap_struct(janet_struct_end(st));
   }
 
-  CALL_SD_BUS_FUNC(sd_bus_message_exit_container, msg);
+  JanetTable *tbl = janet_table(n);
+  for (int32_t i = 0; i < n; i++)
+    janet_table_put(tbl, kvs[2 * i], kvs[2 * i + 1]);
+
   return janet_wrap_table(tbl);
 }
 
-static Janet read_array_type(sd_bus_message *msg, const char *signature) {
-  JanetArray *array = janet_array(1);
+#define UNPACK_ARRAY(c_type, wrap)                                             \
+  do {                                                                         \
+    const c_type *src = ptr;                                                   \
+    for (int32_t i = 0; i < n; i++)                                            \
+      data[i] = wrap(src[i]);                                                  \
+  } while (0)
+
+// Read an array of fixed-width values in one step. Byte arrays, and
+// any fixed-width array when packed decoding is requested, are
+// returned as a buffer of native-endian values, or a string if frozen.
+static Janet read_fixed_array(Decoder *d, char type) {
+  const void *ptr = NULL;
+  size_t size     = 0;
+  CALL_SD_BUS_FUNC(sd_bus_message_read_array, d->msg, type, &ptr, &size);
+
+  g_decode_allocs++;
+  if (type == SD_BUS_TYPE_BYTE || (d->flags & DECODE_PACKED)) {
+    if (d->flags & DECODE_FROZEN)
+      return janet_stringv(ptr, (int32_t) size);
+
+    JanetBuffer *buffer = janet_buffer((int32_t) size);
+    if (size > 0)
+      janet_buffer_push_bytes(buffer, ptr, (int32_t) size);
+
+    return janet_wrap_buffer(buffer);
+  }
+
+  int32_t n         = (int32_t) (size / fixed_type_size(type));
+  JanetArray *array = NULL;
+  Janet *data;
+  if (d->flags & DECODE_FROZEN) {
+    data = janet_tuple_begin(n);
+  } else {
+    array = janet_array(n);
+    data  = array->data;
+  }
+
+  switch (type) {
+    case 'b':
+      UNPACK_ARRAY(uint32_t, janet_wrap_boolean);
+      break;
+    case 'n':
+      UNPACK_ARRAY(int16_t, janet_wrap_number);
+      break;
+    case 'q':
+      UNPACK_ARRAY(uint16_t, janet_wrap_number);
+      break;
+    case 'i':
+      UNPACK_ARRAY(int32_t, janet_wrap_number);
+      break;
+    case 'u':
+      UNPACK_ARRAY(uint32_t, janet_wrap_number);
+      break;
+    case 'x':
+      UNPACK_ARRAY(int64_t, janet_wrap_s64);
+      g_decode_allocs += n;
+      break;
+    case 't':
+      UNPACK_ARRAY(uint64_t, janet_wrap_u64);
+      g_decode_allocs += n;
+      break;
+    case 'd':
+      UNPACK_ARRAY(double, janet_wrap_number);
+      break;
+  }
+
+  if (!array)
+    return janet_wrap_tuple(janet_tuple_end(data));
+
+  array->count = n;
+  return janet_wrap_array(array);
+}
+
+static Janet read_array_type(Decoder *d, const char *signature) {
+  if (fixed_type_size(signature[0]) && signature[1] == '\0')
+    return read_fixed_array(d, signature[0]);
 
-  CALL_SD_BUS_FUNC(sd_bus_message_enter_container, msg, SD_BUS_TYPE_ARRAY,
+  CALL_SD_BUS_FUNC(sd_bus_message_enter_container, d->msg, SD_BUS_TYPE_ARRAY,
                    signature);
 
+  int32_t base = d->top;
+
   Janet obj;
-  while (read_complete_type(msg, &obj) > 0)
-    janet_array_push(array, obj);
+  while (read_complete_type(d, &obj) > 0)
+    stack_push(d, obj);
 
-  CALL_SD_BUS_FUNC(sd_bus_message_exit_container, msg);
-  return janet_wrap_array(array);
+  CALL_SD_BUS_FUNC(sd_bus_message_exit_container, d->msg);
+
+  int32_t n = d->top - base;
+  d->top    = base;
+  g_decode_allocs++;
+
+  if (d->flags & DECODE_FROZEN)
+    return janet_wrap_tuple(janet_tuple_n(d->stack + base, n));
+
+  return janet_wrap_array(janet_array_n(d->stack + base, n));
 }
 
-static Janet read_fd_type(sd_bus_message *msg) {
+static Janet read_fd_type(Decoder *d) {
   int32_t flags = 0;
   int fd;
-  CALL_SD_BUS_FUNC(sd_bus_message_read_basic, msg, 'h', &fd);
+  CALL_SD_BUS_FUNC(sd_bus_message_read_basic, d->msg, 'h', &fd);
+
+  Janet blob;
+  if ((d->flags & DECODE_BLOBS) && blob_from_fd(fd, &blob)) {
+    g_decode_allocs++;
+    return blob;
+  }
 
   int copy;
   if ((copy = fcntl(fd, F_DUPFD_CLOEXEC, 3)) == -1)
@@ -474,10 +704,11 @@ static Janet read_fd_type(sd_bus_message *msg) {
   }
 
   JanetStream *stream = janet_stream(copy, flags, NULL);
+  g_decode_allocs++;
   return janet_wrap_abstract(stream);
 }
 
-static Janet read_basic_type(sd_bus_message *msg, char type) {
+Janet read_basic_type(Decoder *d, char type) {
   switch (type) {
     case 'b': // boolean
       DBUS_TO_JANET_NUM(boolean, int, 'b');
@@ -492,8 +723,10 @@ static Janet read_basic_type(sd_bus_message *msg, char type) {
     case 'u': // uint32_t
       DBUS_TO_JANET_NUM(number, uint32_t, 'u');
     case 'x': // int64_t
+      g_decode_allocs++;
       DBUS_TO_JANET_NUM(s64, int64_t, 'x');
     case 't': // uint64_t
+      g_decode_allocs++;
       DBUS_TO_JANET_NUM(u64, uint64_t, 't');
     case 'd': // double
       DBUS_TO_JANET_NUM(number, double, 'd');
@@ -504,19 +737,46 @@ static Janet read_basic_type(sd_bus_message *msg, char type) {
     case 'g': // signature
       DBUS_TO_JANET_STR('g');
     case 'h': // file descriptor
-      return read_fd_type(msg);
+      return read_fd_type(d);
   }
 
   janet_panicf("Unsupported basic type: %c", type);
 }
 
+// Read a dictionary key, as a keyword if requested for string types
+Janet read_dict_key(Decoder *d, char type) {
+  bool string_type = type == SD_BUS_TYPE_STRING ||
+                     type == SD_BUS_TYPE_OBJECT_PATH ||
+                     type == SD_BUS_TYPE_SIGNATURE;
+  if ((d->flags & DECODE_KEYWORDS) && string_type) {
+    const char *x;
+    CALL_SD_BUS_FUNC(sd_bus_message_read_basic, d->msg, type, &x);
+    return janet_ckeywordv(x);
+  }
+
+  return read_basic_type(d, type);
+}
+
+// Get the message argument at `n`, or create one if it is a message
+// template with `args` as the message body.
+sd_bus_message **get_message(const Janet *argv, int32_t n, const Janet *args,
+                             int32_t nargs) {
+  if (janet_checkabstract(argv[n], &dbus_template_type))
+    return template_instantiate(argv, n, args, nargs);
+
+  if (nargs > 0)
+    janet_panic("message arguments require a message template");
+
+  return janet_getabstract(argv, n, &dbus_message_type);
+}
+
 JANET_FN(
     cfun_message_new_method_call,
     "(sdbus/message-new-method-call bus destination path interface member)",
     "Create a new D-Bus method call message.") {
   janet_fixarity(argc, 5);
 
-  Conn *conn              = janet_getabstract(argv, 0, &dbus_bus_type);
+  Conn *conn              = getconn(argv, 0);
   const char *destination = janet_getcstring(argv, 1);
   const char *path        = janet_getcstring(argv, 2);
   const char *interface   = janet_getcstring(argv, 3);
@@ -555,7 +815,7 @@ JANET_FN(cfun_message_new_signal,
          "Create a new D-Bus signal message.") {
   janet_fixarity(argc, 4);
 
-  Conn *conn            = janet_getabstract(argv, 0, &dbus_bus_type);
+  Conn *conn            = getconn(argv, 0);
   const char *path      = janet_getcstring(argv, 1);
   const char *interface = janet_getcstring(argv, 2);
   const char *member    = janet_getcstring(argv, 3);
@@ -592,11 +852,15 @@ JANET_FN(cfun_message_new_method_error,
   return janet_wrap_abstract(reply_ptr);
 }
 
-JANET_FN(cfun_message_send, "(sdbus/message-send msg)", "Send a message.") {
-  janet_fixarity(argc, 1);
+JANET_FN(cfun_message_send, "(sdbus/message-send msg & args)",
+         "Send a message. `msg` may also be a message template, in which "
+         "case a new message is created with `args` appended according to "
+         "the template's body signature.") {
+  janet_arity(argc, 1, -1);
 
-  sd_bus_message **msg_ptr = janet_getabstract(argv, 0, &dbus_message_type);
+  sd_bus_message **msg_ptr = get_message(argv, 0, argv + 1, argc - 1);
   CALL_SD_BUS_FUNC(sd_bus_message_send, *msg_ptr);
+  capture_message(*msg_ptr);
 
   return janet_wrap_nil();
 }
@@ -641,56 +905,112 @@ JANET_FN(
 }
 
 JANET_FN(cfun_message_append, "(sdbus/message-append msg signature & args)",
-         "Append arguments to a message per a D-Bus signature. Returns nil.") {
+         "Append arguments to a message per a D-Bus signature. Returns nil.\n\n"
+         "`signature` may be either a signature string or a compiled "
+         "signature from `sdbus/compile-signature`.") {
   janet_arity(argc, 3, -1);
 
-  sd_bus_message **msg_ptr = janet_getabstract(argv, 0, &dbus_message_type);
-  const char *signature    = janet_getcstring(argv, 1);
+  sd_bus_message **msg_ptr   = janet_getabstract(argv, 0, &dbus_message_type);
+  const Signature *signature = getsignature(argv, 1);
 
   append_data(*msg_ptr, signature, argv + 2, argc - 2);
 
   return janet_wrap_nil();
 }
 
+// Read up to `n` complete types from the cursor, or every remaining
+// one if `n` is negative, optionally rewinding to the start of the
+// message first. Returns nil, a single value, or an array of values as
+// `sdbus/message-read` does.
+Janet read_items(sd_bus_message *msg, uint64_t flags, bool rewind,
+                 int32_t n) {
+  Decoder d = { .msg = msg, .flags = flags };
+
+  view_cursor_reset(msg);
+  if (rewind)
+    CALL_SD_BUS_FUNC(sd_bus_message_rewind, msg, true);
+
+  Janet item;
+  for (int32_t i = 0; n < 0 || i < n; i++) {
+    if (read_complete_type(&d, &item) == 0)
+      break;
+
+    stack_push(&d, item);
+  }
+
+  // Follow Janet's file/read and return nil on end-of-message
+  Janet result;
+  if (d.top == 0)
+    result = janet_wrap_nil();
+  else if (d.top == 1)
+    result = d.stack[0];
+  else
+    result = janet_wrap_array(janet_array_n(d.stack, d.top));
+
+  decoder_deinit(&d);
+  return result;
+}
+
 JANET_FN(
-    cfun_message_read, "(sdbus/message-read msg &opt what)",
+    cfun_message_read, "(sdbus/message-read msg &opt what flags)",
     "Read items from a D-Bus message. Returns an array for "
     "multiple items, a single value for one, or nil if empty or upon "
     "end-of-message.\n\n"
     "The optional argument `what` may be one of:\n"
     "- `:all` - read the entire message from start\n"
     "- `:rest` - read from the current cursor position until end-of-message\n"
-    "- `n` (positive integer) - read up to `n` items") {
-  janet_arity(argc, 1, 2);
+    "- `n` (positive integer) - read up to `n` items\n\n"
+    "The optional `flags` keyword controls how values are decoded:\n"
+    "- `:p` - return all fixed-width arrays as buffers of native-endian "
+    "values rather than arrays. Byte arrays are always returned as "
+    "buffers.\n"
+    "- `:k` - return string, object path, and signature dictionary keys "
+    "as keywords.\n"
+    "- `:f` - return immutable values: tuples instead of arrays, structs "
+    "instead of tables, and strings instead of buffers.\n"
+    "- `:b` - return file descriptors referring to sealed memfds as "
+    "read-only blobs mapped into memory, see `sdbus/blob`.\n\n"
+    "Flags may be combined, for example `:pk`.") {
+  janet_arity(argc, 1, 3);
 
   sd_bus_message **msg_ptr = janet_getabstract(argv, 0, &dbus_message_type);
 
-  JanetArray *array = janet_array(1);
-  Janet item;
-  if (argc == 2 && janet_checktype(argv[1], JANET_KEYWORD)) {
+  uint64_t flags = 0;
+  if (argc == 3 && !janet_checktype(argv[2], JANET_NIL))
+    flags = janet_getflags(argv, 2, DECODE_FLAGS);
+
+  if (argc >= 2 && janet_checktype(argv[1], JANET_KEYWORD)) {
     JanetKeyword sym = janet_getkeyword(argv, 1);
     if (janet_cstrcmp(sym, "all") == 0)
-      CALL_SD_BUS_FUNC(sd_bus_message_rewind, *msg_ptr, true);
+      return read_items(*msg_ptr, flags, true, -1);
     else if (janet_cstrcmp(sym, "rest") != 0)
       janet_panicf("invalid keyword argument, %v", sym);
 
-    while (read_complete_type(*msg_ptr, &item) > 0)
-      janet_array_push(array, item);
-  } else {
-    int32_t n = janet_optinteger(argv, argc, 1, 1);
-    if (n < 0)
-      janet_panic("expected positive integer argument");
+    return read_items(*msg_ptr, flags, false, -1);
+  }
 
-    for (int32_t i = 0; i < n; i++) {
-      if (read_complete_type(*msg_ptr, &item) == 0)
-        break;
+  int32_t n = janet_optinteger(argv, argc, 1, 1);
+  if (n < 0)
+    janet_panic("expected positive integer argument");
 
-      janet_array_push(array, item);
-    }
-  }
+  return read_items(*msg_ptr, flags, false, n);
+}
 
-  // Follow Janet's file/read and return nil on end-of-message
-  return (array->count < 2) ? janet_array_pop(array) : janet_wrap_array(array);
+JANET_FN(cfun_decode_stats, "(sdbus/decode-stats &opt reset)",
+         "Return a struct with the number of Janet values allocated while "
+         "reading messages on the current thread as `:allocations`, "
+         "counting containers, strings, and boxed integers. If `reset` is "
+         "truthy, the counter is zeroed after reading.") {
+  janet_arity(argc, 0, 1);
+
+  JanetKV *st = janet_struct_begin(1);
+  janet_struct_put(st, janet_ckeywordv("allocations"),
+                   janet_wrap_number((double) g_decode_allocs));
+
+  if (argc == 1 && janet_truthy(argv[0]))
+    g_decode_allocs = 0;
+
+  return janet_wrap_struct(janet_struct_end(st));
 }
 
 JANET_FN(cfun_message_rewind, "(sdbus/message-rewind msg)",
@@ -700,6 +1020,8 @@ JANET_FN(cfun_message_rewind, "(sdbus/message-rewind msg)",
 
   sd_bus_message **msg_ptr = janet_getabstract(argv, 0, &dbus_message_type);
 
+  view_cursor_reset(*msg_ptr);
+
   CALL_SD_BUS_FUNC(sd_bus_message_rewind, *msg_ptr, 1);
   return janet_wrap_nil();
 }
@@ -729,6 +1051,8 @@ JANET_FN(cfun_message_dump, "(sdbus/message-dump msg &opt f)",
   if (f->file && (f->flags & JANET_FILE_CLOSED))
     janet_panic("Cannot dump message to a closed file");
 
+  view_cursor_reset(*msg_ptr);
+
   sd_bus_message_dump(*msg_ptr, f->file, SD_BUS_MESSAGE_DUMP_WITH_HEADER);
   CALL_SD_BUS_FUNC(sd_bus_message_rewind, *msg_ptr, true);
 
@@ -749,6 +1073,7 @@ JanetRegExt cfuns_message[] = {
   JANET_REG("message-get-sender", cfun_message_get_sender),
   JANET_REG("message-append", cfun_message_append),
   JANET_REG("message-read", cfun_message_read),
+  JANET_REG("decode-stats", cfun_decode_stats),
   JANET_REG("message-rewind", cfun_message_rewind),
   JANET_REG("message-seal", cfun_message_seal),
   JANET_REG("message-dump", cfun_message_dump),
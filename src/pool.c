@@ -0,0 +1,238 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Joshua Krusell
+
+#include "common.h"
+
+#define POOL_MAX_SIZE 64
+
+typedef struct {
+  Conn *conn;
+  uint64_t routed; // Messages created on this connection
+} PoolMember;
+
+// Connections to the same bus which new messages are spread across.
+// Calls are sent on the connection that created their message.
+typedef struct {
+  int32_t count;
+  int32_t next;       // Round-robin cursor
+  bool least_pending; // Route to the connection with fewest pending calls
+  bool closed;
+  PoolMember members[];
+} Pool;
+
+static int dbus_pool_gcmark(void *, size_t);
+static int dbus_pool_get(void *, Janet, Janet *);
+static Janet dbus_pool_next(void *, Janet);
+const JanetAbstractType dbus_pool_type = { .name   = "sdbus/pool",
+                                           .gcmark = dbus_pool_gcmark,
+                                           .get    = dbus_pool_get,
+                                           .next   = dbus_pool_next,
+                                           JANET_ATEND_NEXT };
+
+JANET_CFUN(cfun_close_pool);
+static JanetMethod dbus_pool_methods[] = {
+  { "close", cfun_close_pool },
+  { NULL,    NULL            }
+};
+
+static int dbus_pool_gcmark(void *p, size_t size) {
+  UNUSED(size);
+
+  Pool *pool = p;
+  for (int32_t i = 0; i < pool->count; i++)
+    janet_mark(janet_wrap_abstract(pool->members[i].conn));
+
+  return 0;
+}
+
+static int dbus_pool_get(void *p, Janet key, Janet *out) {
+  UNUSED(p);
+  if (!janet_checktype(key, JANET_KEYWORD))
+    return 0;
+
+  return janet_getmethod(janet_unwrap_keyword(key), dbus_pool_methods, out);
+}
+
+static Janet dbus_pool_next(void *p, Janet key) {
+  UNUSED(p);
+  return janet_nextmethod(dbus_pool_methods, key);
+}
+
+static Conn *pool_route(Pool *pool) {
+  if (pool->closed)
+    janet_panic("Pool is closed");
+
+  int32_t best = pool->next;
+  if (pool->least_pending) {
+    // Scan from the cursor so that ties are broken round-robin
+    for (int32_t i = 1; i < pool->count; i++) {
+      int32_t j = (pool->next + i) % pool->count;
+      if (pool->members[j].conn->ncalls < pool->members[best].conn->ncalls)
+        best = j;
+    }
+  }
+
+  pool->next = (best + 1) % pool->count;
+  pool->members[best].routed++;
+
+  return pool->members[best].conn;
+}
+
+Conn *getconn(const Janet *argv, int32_t n) {
+  Pool *pool = janet_checkabstract(argv[n], &dbus_pool_type);
+  if (pool)
+    return pool_route(pool);
+
+  return janet_getabstract(argv, n, &dbus_bus_type);
+}
+
+Conn *pool_conn_for(const Janet *argv, int32_t n, sd_bus_message *msg) {
+  Pool *pool = janet_checkabstract(argv[n], &dbus_pool_type);
+  if (!pool)
+    return janet_getabstract(argv, n, &dbus_bus_type);
+
+  if (pool->closed)
+    janet_panic("Pool is closed");
+
+  sd_bus *bus = sd_bus_message_get_bus(msg);
+  for (int32_t i = 0; i < pool->count; i++) {
+    if (pool->members[i].conn->bus == bus)
+      return pool->members[i].conn;
+  }
+
+  janet_panic("message was not created on a connection of this pool");
+}
+
+static void close_members(Pool *pool) {
+  for (int32_t i = 0; i < pool->count; i++)
+    close_conn(pool->members[i].conn);
+
+  pool->closed = true;
+}
+
+JANET_FN(cfun_open_pool, "(sdbus/open-pool size &opt kind routing)",
+         "Open `size` connections to the user bus, or the system bus if "
+         "`kind` is `:system`. The returned pool may be passed in place "
+         "of a bus to `sdbus/call-method`, `sdbus/call-async`, "
+         "`sdbus/match-async`, `sdbus/message-template`, and the message "
+         "constructors.\n\n"
+         "Each new message, template, or subscription is assigned to one "
+         "connection of the pool and is sent on that connection. With "
+         "`routing` `:least-pending`, the default, messages are assigned to "
+         "the connection with the fewest pending method calls, and with "
+         "`:round-robin` to each connection in turn.\n\n"
+         "The pool must be closed with `sdbus/close-pool` before program "
+         "exit.") {
+  janet_arity(argc, 1, 3);
+
+  int32_t size = janet_getinteger(argv, 0);
+  if (size < 1 || size > POOL_MAX_SIZE)
+    janet_panicf("expected pool size between 1 and %d, got %d",
+                 POOL_MAX_SIZE, size);
+
+  bool system = false;
+  if (argc >= 2 && !janet_checktype(argv[1], JANET_NIL)) {
+    JanetKeyword kind = janet_getkeyword(argv, 1);
+    if (janet_cstrcmp(kind, "system") == 0)
+      system = true;
+    else if (janet_cstrcmp(kind, "user") != 0)
+      janet_panicf("expected :user or :system, got %v", argv[1]);
+  }
+
+  bool least_pending = true;
+  if (argc == 3 && !janet_checktype(argv[2], JANET_NIL)) {
+    JanetKeyword routing = janet_getkeyword(argv, 2);
+    if (janet_cstrcmp(routing, "round-robin") == 0)
+      least_pending = false;
+    else if (janet_cstrcmp(routing, "least-pending") != 0)
+      janet_panicf("expected :least-pending or :round-robin, got %v",
+                   argv[2]);
+  }
+
+  Pool *pool = janet_abstract(&dbus_pool_type,
+                              sizeof(Pool) + size * sizeof(PoolMember));
+  *pool = (Pool) { .least_pending = least_pending };
+
+  // Connections opened before a failure must be closed, otherwise
+  // they keep the event loop alive
+  JanetTryState state;
+  Janet err;
+  if (janet_try(&state)) {
+    err = state.payload;
+    janet_restore(&state);
+    close_members(pool);
+    janet_panicv(err);
+  }
+
+  for (int32_t i = 0; i < size; i++) {
+    Conn *conn = janet_abstract(&dbus_bus_type, sizeof(Conn));
+    memset(conn, 0, sizeof(Conn));
+
+    pool->members[i] = (PoolMember) { .conn = conn };
+    pool->count++;
+
+    if (system)
+      CALL_SD_BUS_FUNC(sd_bus_open_system, &conn->bus);
+    else
+      CALL_SD_BUS_FUNC(sd_bus_open_user, &conn->bus);
+
+    init_async(conn);
+  }
+
+  janet_restore(&state);
+
+  return janet_wrap_abstract(pool);
+}
+
+JANET_FN(cfun_close_pool, "(sdbus/close-pool pool)",
+         "Close all connections of a pool. Returns `nil`.") {
+  janet_fixarity(argc, 1);
+
+  Pool *pool = janet_getabstract(argv, 0, &dbus_pool_type);
+  if (!pool->closed)
+    close_members(pool);
+
+  return janet_wrap_nil();
+}
+
+JANET_FN(cfun_pool_stats, "(sdbus/pool-stats pool)",
+         "Return a struct describing the connections of a pool. "
+         "`:pending` is the number of method calls awaiting a reply and "
+         "`:routed` the number of messages, templates, and subscriptions "
+         "assigned, summed over all connections. `:connections` is a "
+         "tuple with the same counts for each connection.") {
+  janet_fixarity(argc, 1);
+
+  Pool *pool = janet_getabstract(argv, 0, &dbus_pool_type);
+
+  double pending = 0, routed = 0;
+  Janet *connections = janet_tuple_begin(pool->count);
+  for (int32_t i = 0; i < pool->count; i++) {
+    PoolMember *member = &pool->members[i];
+
+    JanetKV *st = janet_struct_begin(2);
+    janet_struct_put(st, janet_ckeywordv("pending"),
+                     janet_wrap_integer(member->conn->ncalls));
+    janet_struct_put(st, janet_ckeywordv("routed"),
+                     janet_wrap_number((double) member->routed));
+    connections[i] = janet_wrap_struct(janet_struct_end(st));
+
+    pending += member->conn->ncalls;
+    routed += (double) member->routed;
+  }
+
+  JanetKV *st = janet_struct_begin(3);
+  janet_struct_put(st, janet_ckeywordv("pending"), janet_wrap_number(pending));
+  janet_struct_put(st, janet_ckeywordv("routed"), janet_wrap_number(routed));
+  janet_struct_put(st, janet_ckeywordv("connections"),
+                   janet_wrap_tuple(janet_tuple_end(connections)));
+
+  return janet_wrap_struct(janet_struct_end(st));
+}
+
+JanetRegExt cfuns_pool[] = {
+  JANET_REG("open-pool", cfun_open_pool),
+  JANET_REG("close-pool", cfun_close_pool),
+  JANET_REG("pool-stats", cfun_pool_stats),
+  JANET_REG_END
+};
@@ -0,0 +1,285 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Joshua Krusell
+
+#include "common.h"
+
+// Maximum signature length per the D-Bus specification
+#define SIGNATURE_MAX_LEN 255
+
+// Number of compiled signatures kept per thread before the cache is
+// flushed
+#define SIGNATURE_CACHE_MAX 256
+
+// Scratch state used while compiling a signature
+typedef struct {
+  SignatureNode *nodes;
+  uint32_t count;
+  char *pool;
+  size_t pool_len;
+} Compiler;
+
+static void dbus_signature_tostring(void *, JanetBuffer *);
+const JanetAbstractType dbus_signature_type = {
+  .name     = "sdbus/signature",
+  .tostring = dbus_signature_tostring,
+  JANET_ATEND_TOSTRING
+};
+
+// Per-thread cache of compiled signatures keyed by signature string
+static JANET_THREAD_LOCAL JanetTable *g_signature_cache;
+
+static void dbus_signature_tostring(void *p, JanetBuffer *buffer) {
+  Signature *signature = p;
+  janet_buffer_push_cstring(buffer, signature->signature);
+}
+
+bool is_basic_type(int ch) {
+  return ch != '\0' && strchr("ybnqiuxtdsogh", ch) != NULL;
+}
+
+// Number of complete types in an already validated signature
+uint32_t signature_count(const char *sig) {
+  uint32_t n = 0;
+  int depth  = 0;
+  for (; *sig; sig++) {
+    switch (*sig) {
+      case '(':
+      case '{':
+        depth++;
+        break;
+      case ')':
+      case '}':
+        if (--depth == 0)
+          n++;
+        break;
+      case 'a':
+        break;
+      default:
+        if (depth == 0)
+          n++;
+    }
+  }
+
+  return n;
+}
+
+// Returns offset of matching 'close' character in str
+static size_t match(const char *str, int open, int close) {
+  int depth     = 1;
+  size_t length = 0;
+
+  int ch;
+  while ((ch = *++str)) {
+    if (ch == open)
+      depth++;
+    else if (ch == close)
+      depth--;
+
+    length++;
+    if (depth == 0)
+      return length;
+  }
+
+  janet_panicf("Unmatched %c in signature", open);
+}
+
+// Copy `len` bytes of `str` into the string pool as a NUL-terminated
+// string. The pool is sized from the compiled nodes beforehand.
+static const char *pool_copy(Compiler *c, const char *str, size_t len) {
+  char *dst = c->pool + c->pool_len;
+  memcpy(dst, str, len);
+  dst[len] = '\0';
+
+  c->pool_len += len + 1;
+  return dst;
+}
+
+// Compile the complete type starting at `sig` into the node
+// list. Returns the length of the complete type. Container contents
+// are copied into the string pool once all nodes are known.
+static size_t compile_complete_type(Compiler *c, const char *sig) {
+  uint32_t idx        = c->count++;
+  SignatureNode *node = &c->nodes[idx];
+  *node               = (SignatureNode) { .type = *sig, .sig = sig };
+
+  size_t len;
+  int ch = *sig;
+  if (is_basic_type(ch) || ch == 'v') {
+    len = 1;
+  } else if (ch == '(') {
+    size_t end = match(sig, '(', ')');
+    if (end < 2)
+      janet_panicf("Missing struct signature contents: %s", sig);
+
+    const char *p = sig + 1;
+    while (p < sig + end) {
+      p += compile_complete_type(c, p);
+      node->nfields++;
+    }
+
+    if (p != sig + end)
+      janet_panicf("Malformed struct signature: %s", sig);
+
+    len = end + 1;
+  } else if (ch == 'a' && sig[1] == '{') {
+    size_t end = match(sig + 1, '{', '}');
+    if (end < 3)
+      janet_panicf("incomplete dictionary signature: %s", sig + 1);
+
+    if (!is_basic_type(sig[2]))
+      janet_panicf("dictionary signature key must be a basic type: %s",
+                   sig + 1);
+
+    node->type = SD_BUS_TYPE_DICT_ENTRY_BEGIN;
+
+    compile_complete_type(c, sig + 2);
+    if (3 + compile_complete_type(c, sig + 3) != end + 1)
+      janet_panicf("dictionary entry must contain exactly two types: %S",
+                   janet_string((const uint8_t *) sig + 1, end + 1));
+
+    len = end + 2;
+  } else if (ch == 'a') {
+    if (!sig[1])
+      janet_panic("Missing array signature");
+
+    len = compile_complete_type(c, sig + 1) + 1;
+  } else {
+    janet_panicf("Unsupported argument type: %c", ch);
+  }
+
+  node->len  = len;
+  node->next = c->count;
+
+  return len;
+}
+
+#define REBASE(ptr, from, to) ((ptr) ? (to) + ((ptr) - (from)) : NULL)
+
+// Copy the contents of a container node into the string pool
+static void copy_contents(Compiler *c, SignatureNode *node) {
+  switch (node->type) {
+    case SD_BUS_TYPE_STRUCT_BEGIN:
+      // Exclude opening/closing parentheses
+      node->contents = pool_copy(c, node->sig + 1, node->len - 2);
+      break;
+    case SD_BUS_TYPE_DICT_ENTRY_BEGIN:
+      // Opening/closing braces are included for the array container,
+      // but not the dictionary entry itself.
+      node->contents = pool_copy(c, node->sig + 1, node->len - 1);
+      node->entry    = pool_copy(c, node->sig + 2, node->len - 3);
+      break;
+    case SD_BUS_TYPE_ARRAY:
+      node->contents = pool_copy(c, node->sig + 1, node->len - 1);
+      break;
+  }
+}
+
+// Bytes needed in the string pool for the contents of a container node
+static size_t contents_size(const SignatureNode *node) {
+  switch (node->type) {
+    case SD_BUS_TYPE_STRUCT_BEGIN:
+      return node->len - 1;
+    case SD_BUS_TYPE_DICT_ENTRY_BEGIN:
+      return 2 * node->len - 2;
+    case SD_BUS_TYPE_ARRAY:
+      return node->len;
+    default:
+      return 0;
+  }
+}
+
+static Signature *compile_signature(const char *signature, size_t len) {
+  if (len > SIGNATURE_MAX_LEN)
+    janet_panicf("Signature exceeds maximum length of %d: %s",
+                 SIGNATURE_MAX_LEN, signature);
+
+  // Each node consumes at least one character of the signature
+  Compiler c = { 0 };
+  c.nodes    = janet_smalloc((len + 1) * sizeof(SignatureNode));
+
+  uint32_t nargs = 0;
+  for (const char *p = signature; *p; nargs++)
+    p += compile_complete_type(&c, p);
+
+  size_t pool_size = len + 1;
+  for (uint32_t i = 0; i < c.count; i++)
+    pool_size += contents_size(&c.nodes[i]);
+
+  size_t nodes_size = c.count * sizeof(SignatureNode);
+  Signature *compiled =
+      janet_abstract(&dbus_signature_type,
+                     sizeof(Signature) + nodes_size + pool_size);
+
+  c.pool = (char *) compiled->nodes + nodes_size;
+
+  compiled->signature = pool_copy(&c, signature, len);
+  compiled->count     = c.count;
+  compiled->nargs     = nargs;
+
+  for (uint32_t i = 0; i < c.count; i++) {
+    SignatureNode node = c.nodes[i];
+    node.sig           = compiled->signature + (node.sig - signature);
+    copy_contents(&c, &node);
+
+    compiled->nodes[i] = node;
+  }
+
+  janet_sfree(c.nodes);
+
+  return compiled;
+}
+
+// Look up a signature string in the per-thread cache, compiling and
+// caching it on a miss.
+//
+// Evicted signatures are only reclaimed by the garbage collector, so
+// pointers returned from here remain valid for the duration of a
+// C function that does not call back into Janet.
+const Signature *signature_lookup(JanetString str) {
+  if (!g_signature_cache) {
+    g_signature_cache = janet_table(SIGNATURE_CACHE_MAX);
+    janet_gcroot(janet_wrap_table(g_signature_cache));
+  }
+
+  Janet key    = janet_wrap_string(str);
+  Janet cached = janet_table_get(g_signature_cache, key);
+  if (janet_checktype(cached, JANET_ABSTRACT))
+    return janet_unwrap_abstract(cached);
+
+  if (g_signature_cache->count >= SIGNATURE_CACHE_MAX)
+    janet_table_clear(g_signature_cache);
+
+  Signature *compiled =
+      compile_signature((const char *) str, janet_string_length(str));
+  janet_table_put(g_signature_cache, key, janet_wrap_abstract(compiled));
+
+  return compiled;
+}
+
+const Signature *getsignature(const Janet *argv, int32_t n) {
+  if (janet_checktype(argv[n], JANET_STRING))
+    return signature_lookup(janet_unwrap_string(argv[n]));
+
+  return janet_getabstract(argv, n, &dbus_signature_type);
+}
+
+JANET_FN(cfun_compile_signature, "(sdbus/compile-signature signature)",
+         "Pre-parse a D-Bus signature string. Returns a compiled signature "
+         "that may be passed in place of a signature string to "
+         "`sdbus/message-append`, `sdbus/call-method`, and "
+         "`sdbus/emit-signal`.\n\n"
+         "Plain signature strings are compiled on first use and cached "
+         "per thread, so this is mainly useful to validate a signature "
+         "up front or to keep hot signatures out of the cache.") {
+  janet_fixarity(argc, 1);
+
+  JanetString signature = janet_getstring(argv, 0);
+  Signature *compiled   = compile_signature((const char *) signature,
+                                            janet_string_length(signature));
+
+  return janet_wrap_abstract(compiled);
+}
+
+JanetRegExt cfuns_signature[] = {
+  JANET_REG("compile-signature", cfun_compile_signature), JANET_REG_END
+};
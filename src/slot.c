@@ -4,14 +4,18 @@
 #include "common.h"
 
 static int dbus_slot_gc(void *, size_t);
+static int dbus_slot_get(void *, Janet, Janet *);
 static Janet dbus_slot_next(void *, Janet);
 const JanetAbstractType dbus_slot_type = { .name = "sdbus/slot",
                                            .gc   = dbus_slot_gc,
+                                           .get  = dbus_slot_get,
                                            .next = dbus_slot_next };
 
 JANET_CFUN(cfun_cancel_slot);
+JANET_CFUN(cfun_match_stats);
 static JanetMethod dbus_slot_methods[] = {
   { "close", cfun_cancel_slot },
+  { "stats", cfun_match_stats },
   { NULL,    NULL             }
 };
 
@@ -25,6 +29,14 @@ static int dbus_slot_gc(void *p, size_t size) {
   return 0;
 }
 
+static int dbus_slot_get(void *p, Janet key, Janet *out) {
+  UNUSED(p);
+  if (!janet_checktype(key, JANET_KEYWORD))
+    return 0;
+
+  return janet_getmethod(janet_unwrap_keyword(key), dbus_slot_methods, out);
+}
+
 static Janet dbus_slot_next(void *p, Janet key) {
   UNUSED(p);
   return janet_nextmethod(dbus_slot_methods, key);
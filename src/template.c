@@ -0,0 +1,198 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Joshua Krusell
+
+#include "common.h"
+
+// Message headers and compiled body signature. Header strings are
+// stored inline after the struct, and sd-bus still validates them for
+// each message created from the template.
+typedef struct {
+  Conn *conn;
+  uint8_t type;               // Method call or signal
+  const Signature *signature; // Body signature, NULL if none
+  const char *destination;    // NULL for signals
+  const char *path;
+  const char *interface;
+  const char *member;
+  char data[];
+} MessageTemplate;
+
+static int dbus_template_gcmark(void *, size_t);
+static void dbus_template_tostring(void *, JanetBuffer *);
+const JanetAbstractType dbus_template_type = {
+  .name     = "sdbus/message-template",
+  .gcmark   = dbus_template_gcmark,
+  .tostring = dbus_template_tostring,
+  JANET_ATEND_TOSTRING
+};
+
+static int dbus_template_gcmark(void *p, size_t size) {
+  UNUSED(size);
+
+  MessageTemplate *tmpl = p;
+  janet_mark(janet_wrap_abstract(tmpl->conn));
+
+  if (tmpl->signature)
+    janet_mark(janet_wrap_abstract((void *) tmpl->signature));
+
+  return 0;
+}
+
+static void dbus_template_tostring(void *p, JanetBuffer *buffer) {
+  MessageTemplate *tmpl = p;
+
+  janet_buffer_push_cstring(buffer, tmpl->path);
+  janet_buffer_push_u8(buffer, ' ');
+  janet_buffer_push_cstring(buffer, tmpl->interface);
+  janet_buffer_push_u8(buffer, '.');
+  janet_buffer_push_cstring(buffer, tmpl->member);
+
+  if (tmpl->signature) {
+    janet_buffer_push_u8(buffer, ' ');
+    janet_buffer_push_cstring(buffer, tmpl->signature->signature);
+  }
+}
+
+static sd_bus_message *new_message(MessageTemplate *tmpl) {
+  sd_bus_message *msg = NULL;
+  if (tmpl->type == SD_BUS_MESSAGE_METHOD_CALL)
+    CALL_SD_BUS_FUNC(sd_bus_message_new_method_call, tmpl->conn->bus, &msg,
+                     tmpl->destination, tmpl->path, tmpl->interface,
+                     tmpl->member);
+  else
+    CALL_SD_BUS_FUNC(sd_bus_message_new_signal, tmpl->conn->bus, &msg,
+                     tmpl->path, tmpl->interface, tmpl->member);
+
+  return msg;
+}
+
+// Copy a header string into the template's inline storage
+static const char *copy_field(char **dst, const char *str) {
+  if (!str)
+    return NULL;
+
+  size_t len = strlen(str) + 1;
+  memcpy(*dst, str, len);
+
+  const char *copy = *dst;
+  *dst += len;
+
+  return copy;
+}
+
+sd_bus_message **template_instantiate(const Janet *argv, int32_t n,
+                                      const Janet *args, int32_t nargs) {
+  MessageTemplate *tmpl = janet_getabstract(argv, n, &dbus_template_type);
+
+  // Wrap immediately so the message is released if appending fails
+  sd_bus_message **msg_ptr =
+      janet_abstract(&dbus_message_type, sizeof(sd_bus_message *));
+  *msg_ptr = NULL;
+  *msg_ptr = new_message(tmpl);
+
+  if (!tmpl->signature) {
+    if (nargs > 0)
+      janet_panic("message template does not take arguments");
+
+    return msg_ptr;
+  }
+
+  // Streamed arguments run Janet code, which may collect the message
+  // while it is still being appended to
+  Janet msg = janet_wrap_abstract(msg_ptr);
+  janet_gcroot(msg);
+
+  JanetTryState state;
+  JanetSignal signal = janet_try(&state);
+  if (!signal)
+    append_data(*msg_ptr, tmpl->signature, (Janet *) args, nargs);
+
+  janet_restore(&state);
+  janet_gcunroot(msg);
+
+  if (signal)
+    janet_panicv(state.payload);
+
+  return msg_ptr;
+}
+
+JANET_FN(cfun_message_template,
+         "(sdbus/message-template bus kind & headers)",
+         "Create a reusable message template with fixed headers. `kind` "
+         "is either `:method-call`, followed by destination, path, "
+         "interface, and member, or `:signal`, followed by path, "
+         "interface, and member. Either may be followed by an optional "
+         "body signature string or compiled signature.\n\n"
+         "Header strings are copied and the body signature is compiled "
+         "once when the template is created. Headers are checked when the "
+         "template is created and again for each message built from it. "
+         "The template may be passed to `sdbus/message-from-template`, "
+         "`sdbus/message-send`, and `sdbus/call-async` in place of a "
+         "message.") {
+  janet_arity(argc, 5, 7);
+
+  Conn *conn        = getconn(argv, 0);
+  JanetKeyword kind = janet_getkeyword(argv, 1);
+
+  const char *headers[4] = { NULL };
+  uint8_t type;
+  int32_t n;
+  if (janet_cstrcmp(kind, "method-call") == 0) {
+    type = SD_BUS_MESSAGE_METHOD_CALL;
+    n    = 4;
+  } else if (janet_cstrcmp(kind, "signal") == 0) {
+    type = SD_BUS_MESSAGE_SIGNAL;
+    n    = 3;
+  } else {
+    janet_panicf("expected :method-call or :signal, got %v", argv[1]);
+  }
+
+  if (argc < n + 2 || argc > n + 3)
+    janet_panicf("expected %d headers and an optional signature", n);
+
+  // Signals have no destination
+  for (int32_t i = 0; i < n; i++)
+    headers[4 - n + i] = janet_getcstring(argv, 2 + i);
+
+  const Signature *signature = NULL;
+  if (argc == n + 3 && !janet_checktype(argv[n + 2], JANET_NIL))
+    signature = getsignature(argv, n + 2);
+
+  size_t size = 0;
+  for (int32_t i = 0; i < 4; i++)
+    size += headers[i] ? strlen(headers[i]) + 1 : 0;
+
+  MessageTemplate *tmpl =
+      janet_abstract(&dbus_template_type, sizeof(MessageTemplate) + size);
+
+  *tmpl = (MessageTemplate) { .conn = conn, .type = type };
+
+  char *dst         = tmpl->data;
+  tmpl->destination = copy_field(&dst, headers[0]);
+  tmpl->path        = copy_field(&dst, headers[1]);
+  tmpl->interface   = copy_field(&dst, headers[2]);
+  tmpl->member      = copy_field(&dst, headers[3]);
+  tmpl->signature   = signature;
+
+  // Validate the headers by building, and discarding, a message
+  sd_bus_message *msg = new_message(tmpl);
+  sd_bus_message_unref(msg);
+
+  return janet_wrap_abstract(tmpl);
+}
+
+JANET_FN(cfun_message_from_template,
+         "(sdbus/message-from-template template & args)",
+         "Create a new message from a message template, appending `args` "
+         "according to the template's body signature.") {
+  janet_arity(argc, 1, -1);
+
+  sd_bus_message **msg_ptr = template_instantiate(argv, 0, argv + 1, argc - 1);
+  return janet_wrap_abstract(msg_ptr);
+}
+
+JanetRegExt cfuns_template[] = {
+  JANET_REG("message-template", cfun_message_template),
+  JANET_REG("message-from-template", cfun_message_from_template),
+  JANET_REG_END
+};
@@ -16,19 +16,20 @@
 
 #define ERRCTX_MAX_SIG_LEN 16
 
-typedef struct {
-  const char *sig[2];
-  size_t len[2];
-  size_t depth;
-  int32_t argc;
-} ErrorContext;
-
 static JANET_THREAD_LOCAL ErrorContext g_errctx;
 
 void dbus_errctx_reset(void) {
   g_errctx = (ErrorContext) { 0 };
 }
 
+ErrorContext dbus_errctx_save(void) {
+  return g_errctx;
+}
+
+void dbus_errctx_restore(ErrorContext ctx) {
+  g_errctx = ctx;
+}
+
 void dbus_errctx_inc(void) {
   g_errctx.argc++;
 }
@@ -216,7 +217,7 @@ JanetDictView getdictionary(Janet x) {
 
 int getfd(Janet x) {
   if (!(janet_checktype(x, JANET_ABSTRACT))) {
-    dbus_type_error(":core/file or :core/stream", x);
+    dbus_type_error(":core/file, :core/stream, or :sdbus/blob", x);
   }
 
   void *p                     = janet_unwrap_abstract(x);
@@ -239,7 +240,10 @@ int getfd(Janet x) {
     return stream->handle;
   }
 
-  dbus_type_error(":core/file or :core/stream", x);
+  if (at == &dbus_blob_type)
+    return blob_getfd(p);
+
+  dbus_type_error(":core/file, :core/stream, or :sdbus/blob", x);
 
   // Unreachable
   return -1;
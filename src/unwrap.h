@@ -9,7 +9,17 @@
 
 #include <janet.h>
 
+// Argument position and signature used to format type errors
+typedef struct {
+  const char *sig[2];
+  size_t len[2];
+  size_t depth;
+  int32_t argc;
+} ErrorContext;
+
 void dbus_errctx_reset(void);
+ErrorContext dbus_errctx_save(void);
+void dbus_errctx_restore(ErrorContext);
 void dbus_errctx_inc(void);
 void dbus_errctx_set(const char *, size_t);
 void dbus_errctx_exit(void);
@@ -33,4 +43,8 @@ JanetDictView getdictionary(Janet);
 
 int getfd(Janet);
 
+// Sealed memfd blobs, see blob.c
+extern const JanetAbstractType dbus_blob_type;
+extern int blob_getfd(void *);
+
 #endif
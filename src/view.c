@@ -0,0 +1,634 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Joshua Krusell
+
+#include "common.h"
+
+#define MESSAGE_PEEK(msg, type, contents)                                      \
+  CALL_SD_BUS_FUNC(sd_bus_message_peek_type, (msg), (type), (contents))
+
+// Container represented by a view
+typedef enum {
+  ViewMessage,
+  ViewStruct,
+  ViewArray,
+  ViewDict
+} ViewKind;
+
+// Lazily decoded view of a message or a container within it. Views
+// hold no decoded data up front; elements are read on access and
+// cached. Nested containers are returned as child views identified by
+// their path of element ordinals from the start of the message.
+typedef struct {
+  sd_bus_message *msg;   // Viewed message
+  uint64_t flags;        // Decoder flags
+  ViewKind kind;         // Kind of container
+  JanetString signature; // Signature of the container contents
+  int32_t length;        // Number of elements, -1 until counted
+  JanetTable *cache;     // Decoded elements by key
+  JanetTable *index;     // Dictionary entry ordinals by key
+  JanetArray *keys;      // Dictionary keys in message order
+  int32_t depth;         // Number of elements in path
+  int32_t path[];        // Element ordinals leading to this container
+} MessageView;
+
+// Views share the read cursor of their message. To avoid rewinding
+// and re-navigating on sequential access, remember which view last
+// positioned the cursor and at which element. Any other use of the
+// read cursor must call view_cursor_reset.
+static JANET_THREAD_LOCAL struct {
+  MessageView *owner;
+  sd_bus_message *msg; // Message of the owning view
+  int32_t ordinal;
+} g_cursor;
+
+static int dbus_view_gc(void *, size_t);
+static int dbus_view_gcmark(void *, size_t);
+static int dbus_view_get(void *, Janet, Janet *);
+static void dbus_view_tostring(void *, JanetBuffer *);
+static Janet dbus_view_next(void *, Janet);
+static size_t dbus_view_length(void *, size_t);
+const JanetAbstractType dbus_view_type = { .name      = "sdbus/view",
+                                           .gc        = dbus_view_gc,
+                                           .gcmark    = dbus_view_gcmark,
+                                           .get       = dbus_view_get,
+                                           .put       = NULL,
+                                           .marshal   = NULL,
+                                           .unmarshal = NULL,
+                                           .tostring  = dbus_view_tostring,
+                                           .compare   = NULL,
+                                           .hash      = NULL,
+                                           .next      = dbus_view_next,
+                                           .call      = NULL,
+                                           .length    = dbus_view_length,
+                                           JANET_ATEND_LENGTH };
+
+// Forget the cursor position of views of `msg`, or of any message if
+// NULL
+void view_cursor_release(sd_bus_message *msg) {
+  if (!msg || g_cursor.msg == msg)
+    g_cursor.owner = NULL;
+}
+
+// Note that the read cursor of `msg` has been moved outside of views
+// and message iterators
+void view_cursor_reset(sd_bus_message *msg) {
+  view_cursor_release(msg);
+  iterator_invalidate(msg);
+}
+
+static int dbus_view_gc(void *p, size_t size) {
+  UNUSED(size);
+
+  MessageView *view = p;
+  if (g_cursor.owner == view)
+    g_cursor.owner = NULL;
+
+  sd_bus_message_unrefp(&view->msg);
+  view->msg = NULL;
+
+  return 0;
+}
+
+static int dbus_view_gcmark(void *p, size_t size) {
+  UNUSED(size);
+
+  MessageView *view = p;
+  janet_mark(janet_wrap_string(view->signature));
+
+  if (view->cache)
+    janet_mark(janet_wrap_table(view->cache));
+
+  if (view->index)
+    janet_mark(janet_wrap_table(view->index));
+
+  if (view->keys)
+    janet_mark(janet_wrap_array(view->keys));
+
+  return 0;
+}
+
+static void dbus_view_tostring(void *p, JanetBuffer *buffer) {
+  MessageView *view = p;
+  janet_buffer_push_string(buffer, view->signature);
+}
+
+static MessageView *create_view(sd_bus_message *msg, uint64_t flags,
+                                ViewKind kind, JanetString signature,
+                                const int32_t *path, int32_t depth) {
+  MessageView *view = janet_abstract(
+      &dbus_view_type, sizeof(MessageView) + depth * sizeof(int32_t));
+
+  *view = (MessageView) { .msg       = sd_bus_message_ref(msg),
+                          .flags     = flags,
+                          .kind      = kind,
+                          .signature = signature,
+                          .length    = -1,
+                          .depth     = depth };
+
+  if (depth > 0)
+    memcpy(view->path, path, depth * sizeof(int32_t));
+
+  return view;
+}
+
+// Skip up to `n` complete types. Returns the number skipped, which is
+// less than `n` only when reaching the end of an array.
+static int32_t skip_elements(sd_bus_message *msg, int32_t n) {
+  for (int32_t i = 0; i < n; i++) {
+    if (CALL_SD_BUS_FUNC(sd_bus_message_skip, msg, NULL) == 0)
+      return i;
+  }
+
+  return n;
+}
+
+// Enter the dictionary entry at the cursor and skip its key
+static void enter_dict_value(sd_bus_message *msg) {
+  char type;
+  const char *contents = NULL;
+  if (MESSAGE_PEEK(msg, &type, &contents) == 0)
+    janet_panic("Unexpected end of dictionary type");
+
+  CALL_SD_BUS_FUNC(sd_bus_message_enter_container, msg, type, contents);
+  CALL_SD_BUS_FUNC(sd_bus_message_skip, msg, NULL);
+}
+
+// Enter the container at the cursor, passing through any variants
+static ViewKind enter_element(sd_bus_message *msg) {
+  char type;
+  const char *contents = NULL;
+  if (MESSAGE_PEEK(msg, &type, &contents) == 0)
+    janet_panic("Unexpected end of message");
+
+  while (type == SD_BUS_TYPE_VARIANT) {
+    CALL_SD_BUS_FUNC(sd_bus_message_enter_container, msg, type, contents);
+    MESSAGE_PEEK(msg, &type, &contents);
+  }
+
+  CALL_SD_BUS_FUNC(sd_bus_message_enter_container, msg, type, contents);
+
+  if (type == SD_BUS_TYPE_STRUCT)
+    return ViewStruct;
+
+  return (contents[0] == SD_BUS_TYPE_DICT_ENTRY_BEGIN) ? ViewDict : ViewArray;
+}
+
+// Position the read cursor at element `k` of the view. Returns false
+// if the view holds fewer than `k` elements.
+static bool seek_element(MessageView *view, int32_t k) {
+  int32_t skipped;
+  if (g_cursor.owner == view && g_cursor.ordinal <= k) {
+    skipped = g_cursor.ordinal + skip_elements(view->msg, k - g_cursor.ordinal);
+  } else {
+    CALL_SD_BUS_FUNC(sd_bus_message_rewind, view->msg, true);
+
+    ViewKind kind = ViewMessage;
+    for (int32_t i = 0; i < view->depth; i++) {
+      skip_elements(view->msg, view->path[i]);
+      if (kind == ViewDict)
+        enter_dict_value(view->msg);
+
+      kind = enter_element(view->msg);
+    }
+
+    skipped = skip_elements(view->msg, k);
+  }
+
+  iterator_invalidate(view->msg);
+
+  g_cursor.owner   = view;
+  g_cursor.msg     = view->msg;
+  g_cursor.ordinal = skipped;
+
+  // Arrays may end right after the last element skipped
+  return skipped == k &&
+         CALL_SD_BUS_FUNC(sd_bus_message_at_end, view->msg, false) == 0;
+}
+
+// Decode the element at the cursor. Containers other than
+// fixed-width arrays become child views and are skipped over.
+static Janet decode_element(MessageView *view, int32_t k) {
+  char type;
+  const char *contents = NULL;
+  if (MESSAGE_PEEK(view->msg, &type, &contents) == 0)
+    janet_panic("Unexpected end of message");
+
+  if (type == SD_BUS_TYPE_VARIANT) {
+    CALL_SD_BUS_FUNC(sd_bus_message_enter_container, view->msg, type,
+                     contents);
+
+    Janet signature = intern_string(contents);
+    Janet value     = decode_element(view, k);
+
+    CALL_SD_BUS_FUNC(sd_bus_message_exit_container, view->msg);
+    return janet_wrap_tuple(TUPLE(signature, value));
+  }
+
+  bool fixed = type == SD_BUS_TYPE_ARRAY && fixed_type_size(contents[0]) &&
+               contents[1] == '\0';
+  if (type == SD_BUS_TYPE_STRUCT || (type == SD_BUS_TYPE_ARRAY && !fixed)) {
+    ViewKind kind = (type == SD_BUS_TYPE_STRUCT) ? ViewStruct
+                    : (contents[0] == SD_BUS_TYPE_DICT_ENTRY_BEGIN)
+                        ? ViewDict
+                        : ViewArray;
+
+    // Child path is the parent's path followed by `k`
+    int32_t *path = janet_smalloc((view->depth + 1) * sizeof(int32_t));
+    memcpy(path, view->path, view->depth * sizeof(int32_t));
+    path[view->depth] = k;
+
+    MessageView *child = create_view(view->msg, view->flags, kind,
+                                     janet_cstring(contents), path,
+                                     view->depth + 1);
+    janet_sfree(path);
+
+    CALL_SD_BUS_FUNC(sd_bus_message_skip, view->msg, NULL);
+    return janet_wrap_abstract(child);
+  }
+
+  Decoder d = { .msg = view->msg, .flags = view->flags };
+  Janet value;
+  read_complete_type(&d, &value);
+  decoder_deinit(&d);
+
+  return value;
+}
+
+// Read and cache the element at ordinal `k`
+static int view_element(MessageView *view, int32_t k, Janet key, Janet *out) {
+  if (!seek_element(view, k))
+    return 0;
+
+  if (view->kind == ViewDict)
+    enter_dict_value(view->msg);
+
+  *out = decode_element(view, k);
+
+  if (view->kind == ViewDict)
+    CALL_SD_BUS_FUNC(sd_bus_message_exit_container, view->msg);
+
+  g_cursor.ordinal = k + 1;
+
+  if (!view->cache)
+    view->cache = janet_table(1);
+
+  janet_table_put(view->cache, key, *out);
+
+  return 1;
+}
+
+// Count the elements of an array by skipping over them natively
+static void count_array(MessageView *view) {
+  seek_element(view, 0);
+
+  int32_t n;
+  for (n = 0; CALL_SD_BUS_FUNC(sd_bus_message_skip, view->msg, NULL) > 0; n++)
+    ;
+
+  g_cursor.ordinal = n;
+  view->length     = n;
+}
+
+// Read every dictionary key, skipping over values, to map keys onto
+// entry ordinals
+static void index_dict(MessageView *view) {
+  seek_element(view, 0);
+
+  view->index = janet_table(1);
+  view->keys  = janet_array(1);
+
+  Decoder d = { .msg = view->msg, .flags = view->flags };
+  char type;
+  const char *contents = NULL;
+  int32_t n;
+  for (n = 0; MESSAGE_PEEK(view->msg, &type, &contents) > 0; n++) {
+    CALL_SD_BUS_FUNC(sd_bus_message_enter_container, view->msg, type,
+                     contents);
+
+    Janet key = read_dict_key(&d, contents[0]);
+    janet_table_put(view->index, key, janet_wrap_integer(n));
+    janet_array_push(view->keys, key);
+
+    CALL_SD_BUS_FUNC(sd_bus_message_skip, view->msg, NULL);
+    CALL_SD_BUS_FUNC(sd_bus_message_exit_container, view->msg);
+  }
+
+  g_cursor.ordinal = n;
+  view->length     = n;
+}
+
+static int32_t view_length(MessageView *view) {
+  if (view->length >= 0)
+    return view->length;
+
+  switch (view->kind) {
+    case ViewMessage:
+    case ViewStruct:
+      view->length = signature_lookup(view->signature)->nargs;
+      break;
+    case ViewArray:
+      count_array(view);
+      break;
+    case ViewDict:
+      index_dict(view);
+      break;
+  }
+
+  return view->length;
+}
+
+static int dbus_view_get(void *p, Janet key, Janet *out) {
+  MessageView *view = p;
+  if (!view->msg)
+    janet_panic("Message view has been released");
+
+  if (view->cache) {
+    Janet cached = janet_table_get(view->cache, key);
+    if (!janet_checktype(cached, JANET_NIL)) {
+      *out = cached;
+      return 1;
+    }
+  }
+
+  if (view->kind == ViewDict) {
+    if (!view->index)
+      index_dict(view);
+
+    Janet ordinal = janet_table_get(view->index, key);
+    if (janet_checktype(ordinal, JANET_NIL))
+      return 0;
+
+    return view_element(view, janet_unwrap_integer(ordinal), key, out);
+  }
+
+  if (!janet_checkint(key))
+    return 0;
+
+  int32_t k = janet_unwrap_integer(key);
+  if (k < 0)
+    return 0;
+
+  // Structs and the message itself have a fixed number of elements
+  // which would otherwise be an error to skip past.
+  if (view->kind != ViewArray && k >= view_length(view))
+    return 0;
+
+  return view_element(view, k, key, out);
+}
+
+static Janet dbus_view_next(void *p, Janet key) {
+  MessageView *view = p;
+  int32_t n         = view_length(view);
+
+  if (view->kind == ViewDict) {
+    int32_t k = 0;
+    if (!janet_checktype(key, JANET_NIL)) {
+      Janet ordinal = janet_table_get(view->index, key);
+      if (janet_checktype(ordinal, JANET_NIL))
+        return janet_wrap_nil();
+
+      k = janet_unwrap_integer(ordinal) + 1;
+    }
+
+    return (k < n) ? view->keys->data[k] : janet_wrap_nil();
+  }
+
+  int32_t k = 0;
+  if (!janet_checktype(key, JANET_NIL)) {
+    if (!janet_checkint(key))
+      return janet_wrap_nil();
+
+    k = janet_unwrap_integer(key) + 1;
+  }
+
+  return (k >= 0 && k < n) ? janet_wrap_integer(k) : janet_wrap_nil();
+}
+
+static size_t dbus_view_length(void *p, size_t size) {
+  UNUSED(size);
+  return (size_t) view_length(p);
+}
+
+JANET_FN(cfun_message_view, "(sdbus/message-view msg &opt flags)",
+         "Create a lazily decoded view of a D-Bus message. Nothing is read "
+         "until elements are accessed with `get`, `in`, or `next`, at which "
+         "point only the requested elements are decoded and cached.\n\n"
+         "The view is indexed by argument position. Structs, arrays, and "
+         "dictionaries within the message are returned as nested views, "
+         "while basic types, variants, and fixed-width arrays are returned "
+         "as regular Janet values. Dictionary views are keyed by the "
+         "dictionary keys.\n\n"
+         "A view shares the read cursor of `msg`; the cursor is rewound as "
+         "needed. `flags` are the same as for `sdbus/message-read`.") {
+  janet_arity(argc, 1, 2);
+
+  sd_bus_message **msg_ptr = janet_getabstract(argv, 0, &dbus_message_type);
+
+  uint64_t flags = 0;
+  if (argc == 2 && !janet_checktype(argv[1], JANET_NIL))
+    flags = janet_getflags(argv, 1, DECODE_FLAGS);
+
+  const char *signature = sd_bus_message_get_signature(*msg_ptr, true);
+  MessageView *view     = create_view(*msg_ptr, flags, ViewMessage,
+                                      janet_cstring(signature), NULL, 0);
+
+  return janet_wrap_abstract(view);
+}
+
+static bool is_wildcard(Janet segment) {
+  return janet_checktype(segment, JANET_KEYWORD) &&
+         janet_cstrcmp(janet_unwrap_keyword(segment), "*") == 0;
+}
+
+// Skip `n` complete types within the current container. Returns false
+// if the container ends before the n-th element.
+static bool skip_fields(sd_bus_message *msg, int32_t n) {
+  for (int32_t i = 0; i < n; i++) {
+    if (CALL_SD_BUS_FUNC(sd_bus_message_at_end, msg, false) > 0)
+      return false;
+
+    CALL_SD_BUS_FUNC(sd_bus_message_skip, msg, NULL);
+  }
+
+  return CALL_SD_BUS_FUNC(sd_bus_message_at_end, msg, false) == 0;
+}
+
+// Skip over the remainder of the current container
+static void skip_rest(sd_bus_message *msg) {
+  while (CALL_SD_BUS_FUNC(sd_bus_message_at_end, msg, false) == 0)
+    CALL_SD_BUS_FUNC(sd_bus_message_skip, msg, NULL);
+}
+
+// Read a dictionary key and compare against a path segment. String
+// keys are compared in place against strings or keywords without
+// creating a Janet value. 64-bit keys are compared numerically so
+// that plain numbers in the path match them.
+static bool key_matches(Decoder *d, char type, Janet segment) {
+  if (type == SD_BUS_TYPE_STRING || type == SD_BUS_TYPE_OBJECT_PATH ||
+      type == SD_BUS_TYPE_SIGNATURE) {
+    const char *str;
+    CALL_SD_BUS_FUNC(sd_bus_message_read_basic, d->msg, type, &str);
+
+    int flags = JANET_TFLAG_STRING | JANET_TFLAG_KEYWORD;
+    return janet_checktypes(segment, flags) &&
+           janet_cstrcmp(janet_unwrap_string(segment), str) == 0;
+  }
+
+  if (type == SD_BUS_TYPE_INT64 || type == SD_BUS_TYPE_UINT64) {
+    uint64_t value;
+    CALL_SD_BUS_FUNC(sd_bus_message_read_basic, d->msg, type, &value);
+
+    bool is_signed = type == SD_BUS_TYPE_INT64;
+    if (janet_checktype(segment, JANET_NUMBER)) {
+      double n = janet_unwrap_number(segment);
+      return is_signed ? janet_checkint64(segment) &&
+                             (int64_t) n == (int64_t) value
+                       : janet_checkuint64(segment) && (uint64_t) n == value;
+    }
+
+    Janet key = is_signed ? janet_wrap_s64((int64_t) value)
+                          : janet_wrap_u64(value);
+    return janet_equals(key, segment);
+  }
+
+  return janet_equals(read_basic_type(d, type), segment);
+}
+
+static int select_value(Decoder *, const Janet *, int32_t, Janet *);
+
+// Select from the elements of a struct, array, or the message itself
+// by position, or from every element if the segment is a wildcard.
+static int select_elements(Decoder *d, const Janet *path, int32_t n,
+                           Janet *out) {
+  if (is_wildcard(path[0])) {
+    JanetArray *array = janet_array(0);
+    while (CALL_SD_BUS_FUNC(sd_bus_message_at_end, d->msg, false) == 0) {
+      Janet value = janet_wrap_nil();
+      select_value(d, path + 1, n - 1, &value);
+      janet_array_push(array, value);
+    }
+
+    *out = janet_wrap_array(array);
+    return 1;
+  }
+
+  if (!janet_checkint(path[0]))
+    return 0;
+
+  int32_t k = janet_unwrap_integer(path[0]);
+  if (k < 0 || !skip_fields(d->msg, k))
+    return 0;
+
+  return select_value(d, path + 1, n - 1, out);
+}
+
+// Select from the entries of a dictionary by key, or from every entry
+// if the segment is a wildcard.
+static int select_entries(Decoder *d, const Janet *path, int32_t n,
+                          Janet *out) {
+  bool wildcard   = is_wildcard(path[0]);
+  JanetTable *tbl = wildcard ? janet_table(0) : NULL;
+
+  char type;
+  const char *contents = NULL;
+  int found            = 0;
+  while (!found && MESSAGE_PEEK(d->msg, &type, &contents) > 0) {
+    CALL_SD_BUS_FUNC(sd_bus_message_enter_container, d->msg, type, contents);
+
+    if (wildcard) {
+      Janet key = read_dict_key(d, contents[0]);
+      Janet value;
+      if (select_value(d, path + 1, n - 1, &value))
+        janet_table_put(tbl, key, value);
+    } else if (key_matches(d, contents[0], path[0])) {
+      found = select_value(d, path + 1, n - 1, out);
+    } else {
+      CALL_SD_BUS_FUNC(sd_bus_message_skip, d->msg, NULL);
+    }
+
+    CALL_SD_BUS_FUNC(sd_bus_message_exit_container, d->msg);
+  }
+
+  if (wildcard) {
+    *out = janet_wrap_table(tbl);
+    return 1;
+  }
+
+  return found;
+}
+
+// Select the value addressed by `path` from the complete type at the
+// cursor. The complete type is always consumed. Returns 1 if the path
+// resolved to a value, 0 otherwise.
+static int select_value(Decoder *d, const Janet *path, int32_t n,
+                        Janet *out) {
+  if (n == 0)
+    return read_complete_type(d, out);
+
+  char type;
+  const char *contents = NULL;
+  if (MESSAGE_PEEK(d->msg, &type, &contents) == 0)
+    return 0;
+
+  if (is_basic_type(type)) {
+    CALL_SD_BUS_FUNC(sd_bus_message_skip, d->msg, NULL);
+    return 0;
+  }
+
+  // Variants are transparent to path segments
+  CALL_SD_BUS_FUNC(sd_bus_message_enter_container, d->msg, type, contents);
+
+  int found;
+  if (type == SD_BUS_TYPE_VARIANT) {
+    found = select_value(d, path, n, out);
+  } else if (type == SD_BUS_TYPE_ARRAY &&
+             contents[0] == SD_BUS_TYPE_DICT_ENTRY_BEGIN) {
+    found = select_entries(d, path, n, out);
+  } else {
+    found = select_elements(d, path, n, out);
+  }
+
+  // sd-bus refuses to exit a container before its end
+  skip_rest(d->msg);
+  CALL_SD_BUS_FUNC(sd_bus_message_exit_container, d->msg);
+
+  return found;
+}
+
+JANET_FN(cfun_message_select, "(sdbus/message-select msg path &opt flags)",
+         "Read a single value from a D-Bus message addressed by `path`, "
+         "skipping over everything else in the message without decoding "
+         "it. Returns nil if the path does not exist.\n\n"
+         "`path` is an indexed collection whose first element is the "
+         "argument index. Each following element selects into the "
+         "previous value: a field index for structs, an element index for "
+         "arrays, or a key for dictionaries. Variants are passed through "
+         "transparently. The wildcard `:*` selects from every element, "
+         "returning an array for structs and arrays, and a table for "
+         "dictionaries.\n\n"
+         "The message is rewound before reading. `flags` are the same as "
+         "for `sdbus/message-read`.") {
+  janet_arity(argc, 2, 3);
+
+  sd_bus_message **msg_ptr = janet_getabstract(argv, 0, &dbus_message_type);
+  JanetView path           = janet_getindexed(argv, 1);
+  if (path.len == 0)
+    janet_panic("expected non-empty path");
+
+  Decoder d = { .msg = *msg_ptr };
+  if (argc == 3 && !janet_checktype(argv[2], JANET_NIL))
+    d.flags = janet_getflags(argv, 2, DECODE_FLAGS);
+
+  view_cursor_reset(*msg_ptr);
+  CALL_SD_BUS_FUNC(sd_bus_message_rewind, d.msg, true);
+
+  Janet value = janet_wrap_nil();
+  select_elements(&d, path.items, path.len, &value);
+  decoder_deinit(&d);
+
+  return value;
+}
+
+JanetRegExt cfuns_view[] = { JANET_REG("message-select", cfun_message_select),
+                             JANET_REG("message-view", cfun_message_view),
+                             JANET_REG_END };